@@ -0,0 +1,123 @@
+#ifndef autotune_hpp
+#define autotune_hpp
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include "fft.hpp"
+
+//////////////////////
+//   FFT Autotune   //
+//////////////////////
+
+// Times every candidate strategy for one size on a synthetic input and keeps the fastest in the
+// wisdom, so later plans of that size use it without measuring again. The candidates are the column
+// block widths and either one thread or all workers per pass; the estimate is always among them.
+inline fft_strategy autotune_fft(const int2 & size, const fft_kind kind)
+{
+    typedef std::chrono::steady_clock clock;
+    static const int repetitions = 3;
+
+    const fft_strategy estimate = estimate_fft_strategy(size, kind);
+    if (kind == fft_kind::real && !can_real_fft_2d(size)) return estimate;
+
+    const int columns = kind == fft_kind::real ? size.x / 2 : size.x;
+
+    std::vector<fft_strategy> candidates(1, estimate);
+    for (const int block : { 1, 4, 8, 16 })
+    {
+        if (block > std::max(1, columns)) continue;
+        for (const int threads : { 0, 1 })
+        {
+            if (threads == 1 && worker_count() == 1) continue;
+            fft_strategy s;
+            s.columnBlock = block;
+            s.threads = threads;
+            if (s.columnBlock != estimate.columnBlock || s.threads != estimate.threads) candidates.push_back(s);
+        }
+    }
+
+    const size_t n = size_t(size.x) * size.y;
+    tracked_vector<float> input(n);
+    for (size_t i = 0; i < n; ++i) input[i] = float((i * 2654435761u) & 0xffff) / 65535.0f;
+
+    complex_buffer data(kind == fft_kind::real ? n / 2 : n), nyquist(size.y);
+    float * real = reinterpret_cast<float *>(data.data());
+
+    auto time_once = [&](fft_plan_2d * plan)
+    {
+        if (plan) std::copy(input.begin(), input.end(), data.begin());
+        else std::copy(input.begin(), input.end(), real);
+
+        const auto t0 = clock::now();
+        if (plan) plan->execute(data.data());
+        else compute_real_fft_2d(real, size, nyquist.data());
+        return std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+    };
+
+    fft_strategy best = estimate;
+    double bestMs = 0.0;
+    for (const fft_strategy & s : candidates)
+    {
+        // compute_real_fft_2d takes its strategy from the wisdom, so real candidates go through it
+        std::unique_ptr<fft_plan_2d> plan;
+        if (kind == fft_kind::real) fft_wisdom::instance().set(size, kind, s);
+        else plan.reset(new fft_plan_2d(size, s));
+
+        // Warm-up, then the best of a few runs
+        time_once(plan.get());
+        double ms = time_once(plan.get());
+        for (int r = 1; r < repetitions; ++r) ms = std::min(ms, time_once(plan.get()));
+
+        if (bestMs == 0.0 || ms < bestMs)
+        {
+            best = s;
+            bestMs = ms;
+        }
+    }
+
+    fft_wisdom::instance().set(size, kind, best);
+    return best;
+}
+
+// One strategy per line: "complex|real float <width> <height> <columnBlock> <threads>". Wisdom is
+// machine specific, so a file from another machine is only a starting point.
+inline bool save_fft_wisdom(const std::string & path)
+{
+    std::ofstream out(path);
+    if (!out) return false;
+    fft_wisdom::instance().for_each([&](const int2 & size, const fft_kind kind, const fft_strategy & s)
+    {
+        out << (kind == fft_kind::real ? "real" : "complex") << " float " << size.x << " " << size.y << " " << s.columnBlock << " " << s.threads << "\n";
+    });
+    return bool(out);
+}
+
+// Returns the number of strategies read; unknown lines (other precisions, comments) are skipped
+inline int load_fft_wisdom(const std::string & path)
+{
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("couldn't open wisdom " + path);
+
+    int count = 0;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        std::string kind, precision;
+        int2 size;
+        fft_strategy s;
+        if (!(fields >> kind >> precision >> size.x >> size.y >> s.columnBlock >> s.threads)) continue;
+        if (precision != "float" || (kind != "complex" && kind != "real") || size.x < 1 || size.y < 1 || s.columnBlock < 1 || s.threads < 0) continue;
+        fft_wisdom::instance().set(size, kind == "real" ? fft_kind::real : fft_kind::complex, s);
+        ++count;
+    }
+    return count;
+}
+
+#endif // end autotune_hpp
@@ -0,0 +1,406 @@
+#include <iostream>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdint.h>
+#include <complex>
+#include "util.hpp"
+#include "image.hpp"
+#include "fft.hpp"
+#include "spectrum.hpp"
+#include "loader.hpp"
+#include "perf_counters.hpp"
+#include "autotune.hpp"
+#include "psd.hpp"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "third-party/stb/stb_image.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "third-party/stb/stb_image_write.h"
+
+// Times the pipeline kernels on synthetic images, outside the GUI:
+//
+//   benchmark [--sizes pow2|odd|all] [--max-size N] [--kernel name] [--counters] [--autotune] [--wisdom file] [--out results.json] [--baseline results.json]
+//
+// Every kernel is warmed up, then repeated until both a minimum count and a minimum time are reached.
+// Results are written as JSON; passing an earlier file as --baseline flags every kernel whose median
+// got more than 5% slower, and the exit code is then non-zero. --counters adds the hardware counts
+// per call (see perf_counters.hpp). --wisdom loads FFT strategies (autotune.hpp) before timing;
+// --autotune measures them for every size first, and saves them to the --wisdom file if one is given.
+
+/////////////////////////
+//   Timing & Results  //
+/////////////////////////
+
+struct benchmark_result
+{
+    std::string kernel;
+    int2 size;
+    int repetitions = 0;
+    double medianMs = 0.0, p95Ms = 0.0, minMs = 0.0;
+    double flops = 0.0; // per call, 0 for kernels that aren't FFTs
+    counter_sample counts; // per call, averaged over the repetitions
+    int64_t peakBytes = 0; // most tracked memory live at once, inputs included
+
+    double gflops() const { return flops > 0.0 && medianMs > 0.0 ? flops / (medianMs * 1e6) : 0.0; }
+};
+
+// 5 N log2 N, the conventional operation count of a complex FFT of N points
+inline double fft_flops(const double n)
+{
+    return 5.0 * n * std::log2(n);
+}
+
+inline double percentile(std::vector<double> sorted, const double p)
+{
+    std::sort(sorted.begin(), sorted.end());
+    const double rank = p * (sorted.size() - 1);
+    const size_t lo = size_t(rank), hi = std::min(lo + 1, sorted.size() - 1);
+    return sorted[lo] + (sorted[hi] - sorted[lo]) * (rank - lo);
+}
+
+static bool countersEnabled = false;
+
+template <typename F>
+benchmark_result run_benchmark(const std::string & kernel, const int2 size, F f, const double flops = 0.0)
+{
+    typedef std::chrono::steady_clock clock;
+    static const int minRepetitions = 5, maxRepetitions = 200;
+    static const double minTotalMs = 250.0;
+
+    auto time_once = [&]()
+    {
+        const auto t0 = clock::now();
+        f();
+        return std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+    };
+
+    // Warm-up: page in the buffers, build twiddles, spin up the caches
+    const double first = time_once();
+    if (first < 50.0) time_once();
+
+    const counter_sample beginCounts = countersEnabled ? thread_counters::current().read() : counter_sample();
+    profiler::instance().begin_run();
+
+    std::vector<double> samples;
+    double total = 0.0;
+    while ((int) samples.size() < maxRepetitions && ((int) samples.size() < minRepetitions || total < minTotalMs))
+    {
+        samples.push_back(time_once());
+        total += samples.back();
+    }
+
+    const int64_t peakBytes = profiler::instance().run_peak_bytes();
+    profiler::instance().end_run();
+
+    counter_sample counts = countersEnabled ? thread_counters::current().read() - beginCounts : counter_sample();
+    for (auto & v : counts.values) if (v >= 0) v /= (int64_t) samples.size();
+
+    benchmark_result r;
+    r.kernel = kernel;
+    r.size = size;
+    r.repetitions = (int) samples.size();
+    r.medianMs = percentile(samples, 0.5);
+    r.p95Ms = percentile(samples, 0.95);
+    r.minMs = *std::min_element(samples.begin(), samples.end());
+    r.flops = flops;
+    r.counts = counts;
+    r.peakBytes = peakBytes;
+    return r;
+}
+
+// One result per line, so a baseline can be read back without a JSON library
+inline bool write_results(const std::string & path, const std::vector<benchmark_result> & results)
+{
+    std::ofstream out(path);
+    if (!out) return false;
+
+    out << "{\"results\":[\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const benchmark_result & r = results[i];
+        char line[256];
+        snprintf(line, sizeof(line), "{\"kernel\":\"%s\",\"width\":%d,\"height\":%d,\"repetitions\":%d,\"median_ms\":%.6f,\"p95_ms\":%.6f,\"min_ms\":%.6f,\"gflops\":%.4f,\"peak_bytes\":%lld",
+            r.kernel.c_str(), r.size.x, r.size.y, r.repetitions, r.medianMs, r.p95Ms, r.minMs, r.gflops(), (long long) r.peakBytes);
+        out << line;
+        for (int c = 0; c < counter_sample::count; ++c)
+        {
+            if (r.counts.values[c] >= 0) out << ",\"" << counter_sample::name(c) << "\":" << r.counts.values[c];
+        }
+        out << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+    return bool(out);
+}
+
+inline std::vector<benchmark_result> read_results(const std::string & path)
+{
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("couldn't open baseline " + path);
+
+    std::vector<benchmark_result> results;
+    std::string line;
+    while (std::getline(in, line))
+    {
+        char kernel[64];
+        benchmark_result r;
+        if (sscanf(line.c_str(), "{\"kernel\":\"%63[^\"]\",\"width\":%d,\"height\":%d,\"repetitions\":%d,\"median_ms\":%lf,\"p95_ms\":%lf,\"min_ms\":%lf",
+            kernel, &r.size.x, &r.size.y, &r.repetitions, &r.medianMs, &r.p95Ms, &r.minMs) == 7)
+        {
+            r.kernel = kernel;
+            results.push_back(r);
+        }
+    }
+    return results;
+}
+
+///////////////////
+//   Workloads   //
+///////////////////
+
+// Deterministic noise plus a few edges, so neither the FFT nor the PNG encoder sees a trivial input
+inline float synthetic_value(const int x, const int y)
+{
+    uint32_t h = uint32_t(x) * 0x9E3779B1u ^ uint32_t(y) * 0x85EBCA77u;
+    h ^= h >> 15; h *= 0x2C1B3C6Du; h ^= h >> 12;
+    return 0.25f * float(h & 0xffff) / 65535.0f + (((x / 37) + (y / 29)) & 1 ? 0.75f : 0.0f);
+}
+
+inline std::vector<uint8_t> synthetic_png(const int2 size)
+{
+    std::vector<uint8_t> pixels(size_t(size.x) * size.y * 3);
+    for (int y = 0; y < size.y; ++y)
+        for (int x = 0; x < size.x; ++x)
+            for (int c = 0; c < 3; ++c)
+                pixels[(size_t(y) * size.x + x) * 3 + c] = uint8_t(255.0f * clamp(synthetic_value(x + c, y), 0.0f, 1.0f));
+
+    std::vector<uint8_t> file;
+    stbi_write_png_to_func([](void * context, void * data, int size)
+    {
+        auto & out = *static_cast<std::vector<uint8_t> *>(context);
+        out.insert(out.end(), (uint8_t *) data, (uint8_t *) data + size);
+    }, &file, size.x, size.y, 3, pixels.data(), size.x * 3);
+    return file;
+}
+
+inline void benchmark_size(const int2 size, const std::string & only, std::vector<benchmark_result> & results)
+{
+    auto wanted = [&](const char * kernel) { return only.empty() || only == kernel; };
+    const double n = double(size.x) * size.y;
+
+    image_buffer<float, 1> img(size);
+    for (int y = 0; y < size.y; ++y)
+        for (int x = 0; x < size.x; ++x)
+            img.view()(y, x) = synthetic_value(x, y);
+
+    if (wanted("fft_2d"))
+    {
+        complex_buffer data(img.view().num_pixels());
+        results.push_back(run_benchmark("fft_2d", size, [&]()
+        {
+            for (size_t i = 0; i < data.size(); ++i) data[i] = img.alias[i];
+            compute_fft_2d(data.data(), size);
+        }, fft_flops(n)));
+    }
+
+    // The in-place real transform the memory budget falls back to
+    if (wanted("real_fft_2d") && can_real_fft_2d(size))
+    {
+        tracked_vector<float> data(img.view().num_pixels());
+        complex_buffer nyquist(size.y);
+        results.push_back(run_benchmark("real_fft_2d", size, [&]()
+        {
+            std::copy(img.alias, img.alias + data.size(), data.begin());
+            compute_real_fft_2d(data.data(), size, nyquist.data());
+        }, fft_flops(n) / 2));
+    }
+
+    // A 1D transform of one row, batched so even 64 points outlast the clock's resolution
+    if (wanted("kissfft_1d"))
+    {
+        const int batch = std::max(1, (1 << 20) / size.x);
+        const kissfft<float> fft(size.x, false);
+        std::vector<std::complex<float>> in(size.x), out(size.x);
+        for (int x = 0; x < size.x; ++x) in[x] = img.alias[x];
+
+        benchmark_result r = run_benchmark("kissfft_1d", { size.x, 1 }, [&]()
+        {
+            for (int b = 0; b < batch; ++b) fft.transform(in.data(), out.data());
+        });
+        r.medianMs /= batch;
+        r.p95Ms /= batch;
+        r.minMs /= batch;
+        for (auto & v : r.counts.values) if (v >= 0) v /= batch;
+        r.flops = fft_flops(size.x);
+        results.push_back(r);
+    }
+
+    if (wanted("center_fft_image"))
+    {
+        image_buffer<float, 1> centered(size);
+        results.push_back(run_benchmark("center_fft_image", size, [&]() { center_fft_image<float, 1>(img.view(), centered.view()); }));
+    }
+
+    if (wanted("resize_box"))
+    {
+        image_buffer<float, 1> half({ std::max(1, size.x / 2), std::max(1, size.y / 2) });
+        results.push_back(run_benchmark("resize_box", size, [&]() { resize_box(img.view(), half.view()); }));
+    }
+
+    // File bytes to an FFT-ready luminance plane: inflate, unfilter and the channel extraction
+    if (wanted("png_to_luminance"))
+    {
+        const std::vector<uint8_t> file = synthetic_png(size);
+        image_buffer<float, 1> luminance(size);
+        results.push_back(run_benchmark("png_to_luminance", size, [&]()
+        {
+            const loaded_image loaded = load_image(file);
+            loaded.channel(0, 0, luminance_weights, luminance.view());
+        }));
+    }
+
+    if (wanted("magnitudes"))
+    {
+        const complex_buffer spectrum = compute_complex_spectrum(img.view());
+        image_buffer<float, 1> magnitudes(size);
+        results.push_back(run_benchmark("magnitudes", size, [&]() { compute_magnitudes(spectrum.data(), magnitudes.view()); }));
+    }
+
+    // Should cost about one pass over the spectrum once the size's bin tables exist
+    if (wanted("psd"))
+    {
+        const complex_buffer spectrum = compute_complex_spectrum(img.view());
+        image_buffer<float, 1> magnitudes(size);
+        compute_magnitudes(spectrum.data(), magnitudes.view());
+        psd_bin_table::for_size(size);
+        results.push_back(run_benchmark("psd", size, [&]() { compute_power_spectrum_profile(magnitudes.view()); }));
+    }
+}
+
+//////////////
+//   Main   //
+//////////////
+
+int main(int argc, char * argv[])
+{
+    std::string sizeSet = "all", only, outPath = "benchmark.json", baselinePath;
+    std::string wisdomPath;
+    int maxSize = 4096;
+    bool autotune = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--sizes" && hasValue) sizeSet = argv[++i];
+        else if (arg == "--max-size" && hasValue) maxSize = std::atoi(argv[++i]);
+        else if (arg == "--kernel" && hasValue) only = argv[++i];
+        else if (arg == "--out" && hasValue) outPath = argv[++i];
+        else if (arg == "--baseline" && hasValue) baselinePath = argv[++i];
+        else if (arg == "--wisdom" && hasValue) wisdomPath = argv[++i];
+        else if (arg == "--counters") countersEnabled = true;
+        else if (arg == "--autotune") autotune = true;
+        else
+        {
+            std::cout << "usage: benchmark [--sizes pow2|odd|all] [--max-size N] [--kernel name] [--counters] [--autotune] [--wisdom file] [--out file] [--baseline file]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::string reason;
+    if (countersEnabled && !hardware_counters_available(reason))
+    {
+        std::cout << "counters unavailable, timing only: " << reason << std::endl;
+        countersEnabled = false;
+    }
+
+    if (!wisdomPath.empty() && !autotune)
+    {
+        try
+        {
+            std::cout << "Read " << load_fft_wisdom(wisdomPath) << " FFT strategies from " << wisdomPath << std::endl;
+        }
+        catch (const std::exception & e)
+        {
+            std::cout << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Powers of two up to 16384 and odd, mixed-radix sizes between them. The largest sizes need
+    // several GB for the complex buffer, so they only run when --max-size asks for them.
+    std::vector<int> sizes;
+    if (sizeSet != "odd") for (int s = 64; s <= 16384; s *= 2) sizes.push_back(s);
+    if (sizeSet != "pow2") for (int s : { 75, 243, 625, 1215, 3375, 6561, 15625 }) sizes.push_back(s);
+    std::sort(sizes.begin(), sizes.end());
+
+    std::vector<benchmark_result> results;
+    for (const int s : sizes)
+    {
+        if (s > maxSize) continue;
+        if (autotune)
+        {
+            const fft_strategy c = autotune_fft({ s, s }, fft_kind::complex);
+            const fft_strategy r = autotune_fft({ s, s }, fft_kind::real);
+            std::cout << "autotune " << s << "x" << s << ": complex block " << c.columnBlock << " threads " << c.threads << ", real block " << r.columnBlock << " threads " << r.threads << std::endl;
+        }
+
+        const size_t first = results.size();
+        benchmark_size({ s, s }, only, results);
+
+        for (size_t i = first; i < results.size(); ++i)
+        {
+            const benchmark_result & r = results[i];
+            char line[192];
+            snprintf(line, sizeof(line), "%-22s %5dx%-5d median %10.4f ms  p95 %10.4f ms  x%-3d  peak %8.1f MB", r.kernel.c_str(), r.size.x, r.size.y, r.medianMs, r.p95Ms, r.repetitions, r.peakBytes / double(1 << 20));
+            std::cout << line;
+            if (r.flops > 0.0) std::cout << "  " << r.gflops() << " GFLOP/s";
+            if (r.counts.any()) std::cout << "  IPC " << r.counts.ipc() << "  L1D miss " << r.counts.values[counter_sample::l1d_misses] << "  LLC miss " << r.counts.values[counter_sample::llc_misses] << "  dTLB miss " << r.counts.values[counter_sample::dtlb_misses];
+            std::cout << std::endl;
+        }
+    }
+
+    if (autotune && !wisdomPath.empty() && !save_fft_wisdom(wisdomPath)) std::cout << "Couldn't write " << wisdomPath << std::endl;
+
+    if (!write_results(outPath, results)) std::cout << "Couldn't write " << outPath << std::endl;
+    else std::cout << "Wrote " << outPath << std::endl;
+
+    if (baselinePath.empty()) return EXIT_SUCCESS;
+
+    static const double regressionThreshold = 0.05;
+
+    int regressions = 0;
+    try
+    {
+        for (const benchmark_result & base : read_results(baselinePath))
+        {
+            auto it = std::find_if(results.begin(), results.end(), [&](const benchmark_result & r) { return r.kernel == base.kernel && r.size == base.size; });
+            if (it == results.end() || base.medianMs <= 0.0) continue;
+
+            const double change = it->medianMs / base.medianMs - 1.0;
+            if (change > regressionThreshold)
+            {
+                char line[192];
+                snprintf(line, sizeof(line), "REGRESSION %-22s %5dx%-5d %10.4f ms -> %10.4f ms (%+.1f%%)", base.kernel.c_str(), base.size.x, base.size.y, base.medianMs, it->medianMs, change * 100.0);
+                std::cout << line << std::endl;
+                ++regressions;
+            }
+        }
+    }
+    catch (const std::exception & e)
+    {
+        std::cout << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << regressions << " regression(s) over " << int(regressionThreshold * 100) << "% against " << baselinePath << std::endl;
+    return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
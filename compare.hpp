@@ -0,0 +1,169 @@
+#ifndef compare_hpp
+#define compare_hpp
+
+#include <complex>
+#include <vector>
+#include <cmath>
+#include <tuple>
+#include "image.hpp"
+#include "parallel.hpp"
+#include "reduce.hpp"
+#include "spectrum.hpp"
+
+/////////////////////////////
+//   Spectrum Comparison   //
+/////////////////////////////
+
+// What the A/B view shows for each frequency bin
+enum class comparison_mode { log_ratio, difference };
+
+// Spectra of a reference image (a, e.g. the source PNG) and a test image (b, e.g. the compressed DDS
+// made from it), both mean-removed with the zero frequency at the origin
+struct spectrum_pair
+{
+    int2 size;
+    complex_buffer a, b;
+};
+
+// fillA and fillB write each image's luminance into its FFT input. Both images are real, so they
+// share one packed complex transform (see compute_complex_spectrum_pair).
+template <typename FillA, typename FillB>
+spectrum_pair compute_spectrum_pair(const int2 size, FillA fillA, FillB fillB)
+{
+    fft_plan_2d plan(size);
+
+    spectrum_pair p;
+    p.size = size;
+    std::tie(p.a, p.b) = compute_complex_spectrum_pair(plan, fillA, fillB);
+    return p;
+}
+
+// 0 dB maps to mid grey and +-comparison_db_range to white/black
+static const float comparison_db_range = 40.0f;
+
+// log_ratio: 20 log10(|b| / |a|), so energy lost to compression reads dark and energy it adds
+// (block edges, quantization noise) reads bright, already mapped to [0, 1]. difference: the raw
+// magnitudes |b - a|, mapped for display like a spectrum. Centering happens when drawn.
+inline void compute_comparison_image(const spectrum_pair & p, const comparison_mode mode, const image_view<float, 1> & out)
+{
+    assert(out.size == p.size && out.has_unit_pixel_stride());
+    const int width = p.size.x;
+
+    if (mode == comparison_mode::difference)
+    {
+        complex_buffer diff(p.b.size());
+        for (size_t i = 0; i < diff.size(); ++i) diff[i] = p.b[i] - p.a[i];
+        compute_magnitudes(diff.data(), out);
+        return;
+    }
+
+    // Bins far below the reference's peak are numerical noise; keep their ratio finite
+    const float floor = std::max(reduce_magnitudes(p.a.data(), p.a.size()).max * 1e-6f, std::numeric_limits<float>::min());
+
+    parallel_for(0, p.size.y, [&](int y0, int y1, int)
+    {
+        for (int y = y0; y < y1; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                const size_t i = size_t(y) * width + x;
+                const float db = 20.0f * std::log10((std::abs(p.b[i]) + floor) / (std::abs(p.a[i]) + floor));
+                out(y, x) = clamp(0.5f + 0.5f * db / comparison_db_range, 0.0f, 1.0f);
+            }
+        }
+    }, fft_min_band(width));
+}
+
+// Energy of both spectra inside one octave of radial frequency, in cycles per pixel
+struct band_energy
+{
+    float lower, upper;
+    double a = 0.0, b = 0.0;
+
+    // Fraction of the reference's energy missing from the test image; negative when energy was added
+    double loss() const { return a > 0.0 ? 1.0 - b / a : 0.0; }
+};
+
+// Octave bands [0, 1/64), [1/64, 1/32) ... [1/4, 1/2], where the last band also takes the corners
+// beyond Nyquist along the diagonal
+static const int comparison_band_count = 6;
+
+inline int radial_band(const float r)
+{
+    int band = 0;
+    for (float edge = 1.0f / 64.0f; band < comparison_band_count - 1 && r >= edge; edge *= 2.0f) ++band;
+    return band;
+}
+
+// Signed frequency of bin k of an n-point transform, in cycles per sample
+inline float bin_frequency(const int k, const int n)
+{
+    return float(k <= n / 2 ? k : k - n) / float(n);
+}
+
+inline std::vector<band_energy> compare_band_energy(const spectrum_pair & p)
+{
+    const int width = p.size.x;
+    const int minBand = fft_min_band(width);
+
+    std::vector<std::vector<band_energy>> partials(std::max(1, band_count(p.size.y, minBand)), std::vector<band_energy>(comparison_band_count));
+
+    parallel_for(0, p.size.y, [&](int y0, int y1, int band)
+    {
+        std::vector<band_energy> & e = partials[band];
+        for (int y = y0; y < y1; ++y)
+        {
+            const float fy = bin_frequency(y, p.size.y);
+            for (int x = 0; x < width; ++x)
+            {
+                const float fx = bin_frequency(x, width);
+                const size_t i = size_t(y) * width + x;
+                band_energy & b = e[radial_band(std::sqrt(fx * fx + fy * fy))];
+                b.a += std::norm(p.a[i]);
+                b.b += std::norm(p.b[i]);
+            }
+        }
+    }, minBand);
+
+    std::vector<band_energy> bands(comparison_band_count);
+    for (int b = 0; b < comparison_band_count; ++b)
+    {
+        bands[b].lower = b == 0 ? 0.0f : std::ldexp(1.0f, b - 7);
+        bands[b].upper = b == comparison_band_count - 1 ? 0.5f : std::ldexp(1.0f, b - 6);
+        for (const auto & e : partials)
+        {
+            bands[b].a += e[b].a;
+            bands[b].b += e[b].b;
+        }
+    }
+    return bands;
+}
+
+// Block compression works on a grid of blockSize x blockSize texels, so its edge artifacts pile up at
+// multiples of size / blockSize on each axis. Returns those bins (origin at zero frequency, DC left out).
+inline std::vector<int2> block_grid_harmonics(const int2 size, const int blockSize = 4)
+{
+    std::vector<int2> bins;
+    if (size.x % blockSize != 0 || size.y % blockSize != 0) return bins;
+
+    const int2 step = { size.x / blockSize, size.y / blockSize };
+    for (int v = 0; v < blockSize; ++v)
+        for (int u = 0; u < blockSize; ++u)
+            if (u || v) bins.push_back({ u * step.x, v * step.y });
+    return bins;
+}
+
+// Energy at the block-grid harmonics of b relative to a; well above 1 when blocking is visible
+inline double block_harmonic_gain(const spectrum_pair & p, const int blockSize = 4)
+{
+    double a = 0.0, b = 0.0;
+    for (const int2 & bin : block_grid_harmonics(p.size, blockSize))
+    {
+        const size_t i = size_t(bin.y) * p.size.x + bin.x;
+        a += std::norm(p.a[i]);
+        b += std::norm(p.b[i]);
+    }
+    return a > 0.0 ? b / a : 0.0;
+}
+
+#endif // end compare_hpp
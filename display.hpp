@@ -0,0 +1,145 @@
+#ifndef display_hpp
+#define display_hpp
+
+#include <stdint.h>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include "image.hpp"
+#include "parallel.hpp"
+#include "reduce.hpp"
+
+/////////////////////////
+//   Display Mapping   //
+/////////////////////////
+
+// Spectra are kept as raw magnitudes; how they look is decided only when they are drawn, so changing
+// any of this remaps what is on screen without touching the FFT.
+enum class display_scale { linear, log, db };
+
+// What [lo, hi] normalizes over. min_max is dominated by the DC and near-DC bins, hence the large
+// default gain; percentile takes the 1st and 99.9th percentiles from the log histogram gathered with
+// the min/max, which gives usable contrast at a gain of 1.
+enum class display_range { min_max, percentile };
+
+struct display_mapping
+{
+    display_scale scale = display_scale::linear;
+    display_range range = display_range::min_max;
+
+    // Magnitudes are first normalized to [0, 1] over [lo, hi] of the spectrum being shown, as picked
+    // by range. With normalize off they are taken as they are (images already mapped, like log ratios).
+    bool normalize = true;
+    double lowPercentile = 0.01, highPercentile = 0.999;
+
+    // Applied in order after the scale: multiply, clip [clipLow, clipHigh] to [0, 1], then ^(1 / gamma).
+    // The defaults reproduce the original (mag - min) / (max - min) * 64 with white above 1.
+    float gain = 64.0f;
+    float clipLow = 0.0f, clipHigh = 1.0f;
+    float gamma = 1.0f;
+
+    static const char * scale_name(const display_scale s)
+    {
+        switch (s)
+        {
+        case display_scale::log: return "log";
+        case display_scale::db: return "dB";
+        default: return "linear";
+        }
+    }
+
+    // Gain that fills [0, 1] for a scale and range
+    static float default_gain(const display_scale s, const display_range r)
+    {
+        return s == display_scale::linear && r == display_range::min_max ? 64.0f : 1.0f;
+    }
+};
+
+// [lo, hi] of the mapping for a spectrum with these statistics; histogram is only read for percentiles
+inline void display_normalization_range(const display_mapping & m, const reduction & stats, float & lo, float & hi)
+{
+    lo = stats.min;
+    hi = stats.max;
+    if (m.range != display_range::percentile || stats.count == 0) return;
+
+    const float plo = stats.histogram.percentile(m.lowPercentile);
+    const float phi = stats.histogram.percentile(m.highPercentile);
+    if (phi > plo)
+    {
+        lo = std::max(lo, plo);
+        hi = std::min(hi, phi);
+    }
+}
+
+// Decibels below the maximum shown as black on the dB scale
+static const float display_db_range = 100.0f;
+
+inline float map_display_value(const display_mapping & m, const float lo, const float hi, const float v)
+{
+    const float range = hi > lo ? hi - lo : 1.0f;
+
+    float t = v;
+    if (m.normalize)
+    {
+        switch (m.scale)
+        {
+        case display_scale::linear: t = (v - lo) / range; break;
+        case display_scale::log: t = std::log1p(std::max(0.0f, v - lo)) / std::log1p(range); break;
+        case display_scale::db: t = 1.0f + 20.0f * std::log10(std::max(v, hi * 1e-12f) / std::max(hi, std::numeric_limits<float>::min())) / display_db_range; break;
+        }
+    }
+
+    t *= m.gain;
+    t = (t - m.clipLow) / std::max(m.clipHigh - m.clipLow, 1e-6f);
+    t = std::min(std::max(t, 0.0f), 1.0f);
+    return m.gamma != 1.0f ? std::pow(t, 1.0f / m.gamma) : t;
+}
+
+// The mapping tabulated over the bit pattern of non-negative floats: exponent plus the top lut_bits - 8
+// mantissa bits, as log_histogram bins them but finer (0.4% steps), so any magnitude is one lookup.
+// Rebuilding takes well under a millisecond.
+class display_lut
+{
+    static const int lut_bits = 16;
+    std::vector<float> table;
+
+    static uint32_t index_of(const float v)
+    {
+        uint32_t x;
+        std::memcpy(&x, &v, sizeof(x));
+        return (x & 0x80000000u) ? 0 : x >> (32 - lut_bits - 1);
+    }
+
+public:
+
+    display_lut(const display_mapping & m, const float lo, const float hi) : table(size_t(1) << lut_bits)
+    {
+        for (uint32_t i = 0; i < table.size(); ++i)
+        {
+            // The middle of the entry's range of values
+            const uint32_t x = (i << (32 - lut_bits - 1)) | (1u << (32 - lut_bits - 2));
+            float v;
+            std::memcpy(&v, &x, sizeof(v));
+            table[i] = map_display_value(m, lo, hi, std::isfinite(v) ? v : hi);
+        }
+    }
+
+    float operator()(const float v) const { return table[index_of(v)]; }
+
+    void apply(const image_view<const float, 1> & in, const image_view<float, 1> & out) const
+    {
+        assert(in.size == out.size);
+
+        scoped_timer timer("display map");
+        parallel_for(0, in.size.y, [&](int y0, int y1, int)
+        {
+            for (int y = y0; y < y1; ++y)
+                for (int x = 0; x < in.size.x; ++x)
+                    out(y, x) = (*this)(in(y, x));
+        }, std::max(1, (1 << 16) / std::max(1, in.size.x)));
+    }
+};
+
+#endif // end display_hpp
@@ -0,0 +1,295 @@
+#ifndef fft_hpp
+#define fft_hpp
+
+#include <complex>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include "linalg_util.hpp"
+#include "parallel.hpp"
+#include "memory.hpp"
+#include "kissfft/kissfft.hpp"
+
+/////////////////
+//   2D FFT    //
+/////////////////
+
+// Interleaved complex samples, counted by the memory accounting
+typedef tracked_vector<std::complex<float>> complex_buffer;
+
+// Each worker band gets at least this many complex elements, so small transforms stay on one thread
+static const int fft_min_band_elements = 1 << 15;
+
+inline int fft_min_band(const int length)
+{
+    return std::max(1, fft_min_band_elements / std::max(1, length));
+}
+
+// True when compute_fft_2d would not split either pass across workers
+inline bool fft_runs_serial(const int2 & size)
+{
+    return band_count(size.y, fft_min_band(size.x)) <= 1 && band_count(size.x, fft_min_band(size.y)) <= 1;
+}
+
+///////////////////////////
+//   Strategy & Wisdom   //
+///////////////////////////
+
+enum class fft_kind { complex, real };
+
+// How one transform size runs. The column pass gathers columnBlock columns at a time, so every row it
+// touches yields a contiguous run instead of a single element per cache line; threads caps the workers
+// per pass (0 is all of them).
+struct fft_strategy
+{
+    int columnBlock = 1;
+    int threads = 0;
+};
+
+// Without wisdom: block columns while a block still sits comfortably in L2, and let fft_min_band
+// decide the threads
+inline fft_strategy estimate_fft_strategy(const int2 & size, const fft_kind kind)
+{
+    static const size_t blockBudgetBytes = 256 * 1024;
+
+    const int columns = kind == fft_kind::real ? size.x / 2 : size.x;
+    fft_strategy s;
+    for (int block = 16; block > 1; block /= 2)
+    {
+        if (block <= columns && size_t(block + 1) * size.y * sizeof(std::complex<float>) <= blockBudgetBytes)
+        {
+            s.columnBlock = block;
+            break;
+        }
+    }
+    return s;
+}
+
+// Measured winners per (width, height, kind), all single precision. Filled by autotune_fft (see
+// autotune.hpp) or a wisdom file loaded at startup; plans read it when they are built, never per call.
+class fft_wisdom
+{
+    mutable std::mutex mutex;
+    std::map<std::tuple<int, int, int>, fft_strategy> entries;
+
+    static std::tuple<int, int, int> key(const int2 & size, const fft_kind kind) { return std::make_tuple(size.x, size.y, int(kind)); }
+
+public:
+
+    static fft_wisdom & instance()
+    {
+        static fft_wisdom w;
+        return w;
+    }
+
+    bool find(const int2 & size, const fft_kind kind, fft_strategy & s) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key(size, kind));
+        if (it == entries.end()) return false;
+        s = it->second;
+        return true;
+    }
+
+    void set(const int2 & size, const fft_kind kind, const fft_strategy & s)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries[key(size, kind)] = s;
+    }
+
+    // Invokes f(size, kind, strategy) for every entry
+    template <typename F>
+    void for_each(F f) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto & e : entries) f(int2(std::get<0>(e.first), std::get<1>(e.first)), fft_kind(std::get<2>(e.first)), e.second);
+    }
+};
+
+inline fft_strategy choose_fft_strategy(const int2 & size, const fft_kind kind)
+{
+    fft_strategy s;
+    return fft_wisdom::instance().find(size, kind, s) ? s : estimate_fft_strategy(size, kind);
+}
+
+namespace detail
+{
+    // Band size for count items of length elements each on at most threads workers
+    inline int fft_pass_min_band(const int count, const int length, const int threads)
+    {
+        const int minBand = fft_min_band(length);
+        return threads > 0 ? std::max(minBand, (count + threads - 1) / threads) : minBand;
+    }
+
+    // Transforms columns [x0, x1) of a row-major image whose rows are stride complex values, block
+    // columns at a time. scratch holds (block + 1) * height values. store(x, transformed, dst) writes
+    // each finished column into its slot of the block, which is then scattered back row by row.
+    template <typename Store>
+    void fft_columns(const kissfft<float> & fft, std::complex<float> * data, const int stride, const int height, const int x0, const int x1, const int block, std::complex<float> * scratch, Store store)
+    {
+        std::complex<float> * tmp = scratch + size_t(block) * height;
+        for (int bx = x0; bx < x1; bx += block)
+        {
+            const int count = std::min(block, x1 - bx);
+
+            for (int y = 0; y < height; y++)
+            {
+                const std::complex<float> * src = &data[size_t(y) * stride + bx];
+                for (int b = 0; b < count; b++) scratch[size_t(b) * height + y] = src[b];
+            }
+
+            for (int b = 0; b < count; b++)
+            {
+                std::complex<float> * column = scratch + size_t(b) * height;
+                fft.transform(column, tmp);
+                store(bx + b, tmp, column);
+            }
+
+            for (int y = 0; y < height; y++)
+            {
+                std::complex<float> * dst = &data[size_t(y) * stride + bx];
+                for (int b = 0; b < count; b++) dst[b] = scratch[size_t(b) * height + y];
+            }
+        }
+    }
+}
+
+// Twiddles and per-worker scratch rows for one transform size and direction. Transforms of the same
+// size (A/B pairs, channels, mip chains of equal size) reuse a plan instead of rebuilding both.
+// Rows and then columns are split into bands across workers; kissfft::transform is const, so every
+// band shares the same twiddles and only owns its scratch. One execute() at a time per plan.
+class fft_plan_2d
+{
+    int2 size;
+    fft_strategy strategy;
+    kissfft<float> xFFT, yFFT;
+    std::vector<complex_buffer> scratch;
+
+    std::complex<float> * band_scratch(const int band)
+    {
+        auto & s = scratch[band];
+        if (s.empty()) s.resize(std::max(size_t(size.x), size_t(strategy.columnBlock + 1) * size.y));
+        return s.data();
+    }
+
+public:
+
+    fft_plan_2d(const int2 & size, const bool inverse = false) : fft_plan_2d(size, choose_fft_strategy(size, fft_kind::complex), inverse) { }
+
+    fft_plan_2d(const int2 & size, const fft_strategy & strategy, const bool inverse = false) : size(size), strategy(strategy), xFFT(size.x, inverse), yFFT(size.y, inverse), scratch(worker_count())
+    {
+        this->strategy.columnBlock = std::min(std::max(1, strategy.columnBlock), std::max(1, size.x));
+    }
+
+    const int2 & extent() const { return size; }
+
+    // In place
+    void execute(std::complex<float> * data)
+    {
+        const int width = size.x;
+        const int height = size.y;
+        const int block = strategy.columnBlock;
+
+        // Compute FFT on X axis
+        {
+            scoped_timer timer("fft x pass");
+            parallel_for(0, height, [&](int y0, int y1, int band)
+            {
+                std::complex<float> * xTmp = band_scratch(band);
+                for (int y = y0; y < y1; ++y)
+                {
+                    std::complex<float> * row = &data[size_t(y) * width];
+                    xFFT.transform(row, xTmp);
+                    std::copy(xTmp, xTmp + width, row);
+                }
+            }, detail::fft_pass_min_band(height, width, strategy.threads));
+        }
+
+        // Compute FFT on Y axis, gathering blocks of columns into contiguous rows for data locality.
+        // Bands hold whole blocks so neighbouring workers never share a cache line.
+        {
+            scoped_timer timer("fft y pass");
+            const int blocks = (width + block - 1) / block;
+            parallel_for(0, blocks, [&](int b0, int b1, int band)
+            {
+                detail::fft_columns(yFFT, data, width, height, b0 * block, std::min(width, b1 * block), block, band_scratch(band),
+                    [&](int, const std::complex<float> * transformed, std::complex<float> * dst) { std::copy(transformed, transformed + height, dst); });
+            }, std::max(1, detail::fft_pass_min_band(width, height, strategy.threads) / block));
+        }
+    }
+};
+
+// In place
+inline void compute_fft_2d(std::complex<float> * data, const int2 & size, const bool inverse = false)
+{
+    fft_plan_2d plan(size, inverse);
+    plan.execute(data);
+}
+
+inline bool can_real_fft_2d(const int2 & size)
+{
+    return size.x >= 2 && (size.x & 1) == 0;
+}
+
+// Forward FFT of a real image of even width in its own float buffer, at half the memory of the complex
+// transform. Rows go through kissfft's real transform, which leaves bins 0 .. w/2 - 1 of each row as
+// w/2 complex values in place, with the real DC and Nyquist bins packed into the first. After the
+// column pass each row y holds the 2D bins (y, 0 .. w/2 - 1) and nyquist[y] holds bin (y, w/2); the
+// remaining bins are the conjugates of these (Hermitian symmetry of a real input).
+inline void compute_real_fft_2d(float * data, const int2 & size, std::complex<float> * nyquist)
+{
+    assert(can_real_fft_2d(size));
+
+    const int half = size.x / 2;
+    const int height = size.y;
+    std::complex<float> * bins = reinterpret_cast<std::complex<float> *>(data);
+    const kissfft<float> xFFT(half, false), yFFT(height, false);
+    const fft_strategy strategy = choose_fft_strategy(size, fft_kind::real);
+    const int block = std::min(std::max(1, strategy.columnBlock), half);
+
+    {
+        scoped_timer timer("fft x pass");
+        parallel_for(0, height, [&](int y0, int y1, int)
+        {
+            complex_buffer xTmp(half);
+            for (int y = y0; y < y1; ++y)
+            {
+                std::complex<float> * row = &bins[size_t(y) * half];
+                xFFT.transform_real(data + size_t(y) * size.x, xTmp.data());
+                std::copy(xTmp.begin(), xTmp.end(), row);
+            }
+        }, detail::fft_pass_min_band(height, half, strategy.threads));
+    }
+
+    {
+        scoped_timer timer("fft y pass");
+        const int blocks = (half + block - 1) / block;
+        parallel_for(0, blocks, [&](int b0, int b1, int)
+        {
+            complex_buffer scratch(size_t(block + 1) * height);
+            detail::fft_columns(yFFT, bins, half, height, b0 * block, std::min(half, b1 * block), block, scratch.data(),
+                [&](int x, const std::complex<float> * transformed, std::complex<float> * dst)
+            {
+                if (x != 0)
+                {
+                    std::copy(transformed, transformed + height, dst);
+                    return;
+                }
+
+                // Column 0 is DC + i * Nyquist, two real columns sharing one transform; split them as
+                // in compute_complex_spectrum_pair
+                for (int y = 0; y < height; y++)
+                {
+                    const std::complex<float> mirror = std::conj(transformed[(height - y) % height]);
+                    dst[y] = 0.5f * (transformed[y] + mirror);
+                    nyquist[y] = std::complex<float>(0.0f, -0.5f) * (transformed[y] - mirror);
+                }
+            });
+        }, std::max(1, detail::fft_pass_min_band(half, height, strategy.threads) / block));
+    }
+}
+
+#endif // end fft_hpp
@@ -0,0 +1,133 @@
+#ifndef half_hpp
+#define half_hpp
+
+#include <stdint.h>
+#include <cstring>
+#include <cstddef>
+#include "image.hpp"
+
+// MSVC's /arch:AVX2 implies F16C; GCC and Clang need -mf16c on top of -mavx2
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+    #include <immintrin.h>
+    #define HAS_F16C 1
+#endif
+
+//////////////////////////////
+//   Half-Precision Float   //
+//////////////////////////////
+
+// IEEE 754 binary16 storage type. Arithmetic happens in float; this only exists to halve
+// the footprint of buffers that are displayed or retained after the FFT.
+struct float16
+{
+    uint16_t bits;
+};
+
+// Round-to-nearest-even, matching _mm256_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT)
+inline float16 to_half(const float f)
+{
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+
+    const uint16_t sign = (x >> 16) & 0x8000;
+    const uint32_t a = x & 0x7fffffff;
+
+    if (a >= 0x7f800000) return { uint16_t(sign | 0x7c00 | (a > 0x7f800000 ? 0x200 : 0)) }; // inf or nan
+    if (a >= 0x477ff000) return { uint16_t(sign | 0x7c00) }; // rounds past 65504
+    if (a < 0x33000000) return { sign }; // below half the smallest subnormal
+
+    if (a < 0x38800000)
+    {
+        // Subnormal result: shift the implicit-one mantissa into units of 2^-24
+        const uint32_t m = (a & 0x7fffff) | 0x800000;
+        const uint32_t shift = 126 - (a >> 23);
+        const uint32_t rem = m & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        uint32_t r = m >> shift;
+        if (rem > halfway || (rem == halfway && (r & 1))) r++;
+        return { uint16_t(sign | r) };
+    }
+
+    const uint32_t rebiased = a - (112u << 23);
+    return { uint16_t(sign | ((rebiased + 0xfff + ((rebiased >> 13) & 1)) >> 13)) };
+}
+
+inline float to_float(const float16 h)
+{
+    const uint32_t sign = uint32_t(h.bits & 0x8000) << 16;
+    int32_t e = (h.bits >> 10) & 0x1f;
+    uint32_t m = h.bits & 0x3ff;
+    uint32_t x;
+
+    if (e == 0x1f) x = sign | 0x7f800000 | (m << 13);
+    else if (e != 0) x = sign | (uint32_t(e + 112) << 23) | (m << 13);
+    else if (m == 0) x = sign;
+    else
+    {
+        e = 1;
+        while ((m & 0x400) == 0) { m <<= 1; e--; }
+        x = sign | (uint32_t(e + 112) << 23) | ((m & 0x3ff) << 13);
+    }
+
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+inline void convert_to_half(const float * src, float16 * dst, const size_t count)
+{
+    size_t i = 0;
+#if defined(HAS_F16C)
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i *)(dst + i), h);
+    }
+#endif
+    for (; i < count; ++i) dst[i] = to_half(src[i]);
+}
+
+inline void convert_to_float(const float16 * src, float * dst, const size_t count)
+{
+    size_t i = 0;
+#if defined(HAS_F16C)
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i h = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+#endif
+    for (; i < count; ++i) dst[i] = to_float(src[i]);
+}
+
+inline void convert_image(const image_view<const float, 1> & in, const image_view<float16, 1> & out)
+{
+    assert(in.size == out.size);
+
+    if (in.has_unit_pixel_stride() && out.has_unit_pixel_stride())
+    {
+        for (int y = 0; y < in.size.y; y++) convert_to_half(in.row(y), out.row(y), in.size.x);
+        return;
+    }
+
+    for (int y = 0; y < in.size.y; y++)
+        for (int x = 0; x < in.size.x; x++)
+            out(y, x) = to_half(in(y, x));
+}
+
+inline void convert_image(const image_view<const float16, 1> & in, const image_view<float, 1> & out)
+{
+    assert(in.size == out.size);
+
+    if (in.has_unit_pixel_stride() && out.has_unit_pixel_stride())
+    {
+        for (int y = 0; y < in.size.y; y++) convert_to_float(in.row(y), out.row(y), in.size.x);
+        return;
+    }
+
+    for (int y = 0; y < in.size.y; y++)
+        for (int x = 0; x < in.size.x; x++)
+            out(y, x) = to_float(in(y, x));
+}
+
+#endif // end half_hpp
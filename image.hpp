@@ -0,0 +1,504 @@
+#ifndef image_hpp
+#define image_hpp
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+#include <cstring>
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include "util.hpp"
+#include "reduce.hpp"
+#include "parallel.hpp"
+#include "memory.hpp"
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#endif
+
+////////////////////
+//   Image View   //
+////////////////////
+
+// Non-owning window onto interleaved pixel memory. Strides are counted in elements of T:
+// stride.x steps between neighbouring pixels and stride.y between rows. Sub-rectangles,
+// single channel planes and flips are all just different origin/stride pairs.
+template <typename T, int C>
+struct image_view
+{
+    T * origin = nullptr;
+    int2 size = { 0, 0 };
+    int2 stride = { 0, 0 };
+
+    image_view() { }
+    image_view(T * origin, const int2 size) : origin(origin), size(size), stride(C, C * size.x) { }
+    image_view(T * origin, const int2 size, const int2 stride) : origin(origin), size(size), stride(stride) { }
+
+    // Allow image_view<T, C> -> image_view<const T, C>
+    template <typename U, typename = typename std::enable_if<std::is_same<const U, T>::value && !std::is_same<U, T>::value>::type>
+    image_view(const image_view<U, C> & r) : origin(r.origin), size(r.size), stride(r.stride) { }
+
+    int num_pixels() const { return size.x * size.y; }
+    bool empty() const { return size.x <= 0 || size.y <= 0; }
+    bool is_contiguous() const { return stride.x == C && stride.y == C * size.x; }
+    bool has_unit_pixel_stride() const { return stride.x == C && stride.y > 0; }
+
+    T * row(int y) const { return origin + std::ptrdiff_t(y) * stride.y; }
+    T & operator()(int y, int x) const { return origin[std::ptrdiff_t(y) * stride.y + std::ptrdiff_t(x) * stride.x]; }
+    T & operator()(int y, int x, int channel) const { return origin[std::ptrdiff_t(y) * stride.y + std::ptrdiff_t(x) * stride.x + channel]; }
+
+    image_view subrect(const int2 offset, const int2 extent) const
+    {
+        assert(offset.x >= 0 && offset.y >= 0 && offset.x + extent.x <= size.x && offset.y + extent.y <= size.y);
+        return image_view(&(*this)(offset.y, offset.x), extent, stride);
+    }
+
+    image_view<T, 1> channel(const int c) const
+    {
+        assert(c >= 0 && c < C);
+        return image_view<T, 1>(origin + c, size, stride);
+    }
+
+    image_view flip_x() const { return image_view(&(*this)(0, size.x - 1), size, int2(-stride.x, stride.y)); }
+    image_view flip_y() const { return image_view(row(size.y - 1), size, int2(stride.x, -stride.y)); }
+};
+
+//////////////////////
+//   Image Buffer   //
+//////////////////////
+
+template <typename T, int C>
+struct image_buffer
+{
+    const int2 size;
+    T * alias;
+    struct delete_array { void operator()(T * p) { delete[] p; } };
+    std::unique_ptr<T, decltype(image_buffer::delete_array())> data;
+    tracked_allocation tracked;
+    image_buffer() : size({ 0, 0 }), alias(nullptr) { }
+    image_buffer(const int2 size) : size(size), data(new T[size.x * size.y * C], delete_array()), tracked(size_t(size.x) * size.y * C * sizeof(T)) { alias = data.get(); }
+    image_buffer(const image_buffer<T, C> & r) : size(r.size), data(new T[size.x * size.y * C], delete_array()), tracked(r.tracked.size())
+    {
+        alias = data.get();
+        if(r.alias) std::memcpy(alias, r.alias, size.x * size.y * C * sizeof(T));
+    }
+    image_buffer(image_buffer<T, C> && r) : size(r.size), alias(r.alias), data(std::move(r.data)), tracked(std::move(r.tracked)) { r.alias = nullptr; }
+    int size_bytes() const { return C * size.x * size.y * sizeof(T); }
+    int num_pixels() const { return size.x * size.y; }
+    T & operator()(int y, int x) { return alias[y * size.x + x]; }
+    T & operator()(int y, int x, int channel) { return alias[C * (y * size.x + x) + channel]; }
+    image_view<T, C> view() { return image_view<T, C>(alias, size); }
+    image_view<const T, C> view() const { return image_view<const T, C>(alias, size); }
+    T compute_mean() const { return T(reduce_values(alias, size_t(num_pixels()) * C).mean()); }
+};
+
+///////////////////////
+//   Image Kernels   //
+///////////////////////
+
+// Keeps a parameter out of template deduction so mutable views convert to const views implicitly
+template <typename T> struct non_deduced { typedef T type; };
+
+template <typename T, int C>
+void copy_image(const typename non_deduced<image_view<const T, C>>::type & in, const image_view<T, C> & out)
+{
+    assert(in.size == out.size);
+
+    if (in.has_unit_pixel_stride() && out.has_unit_pixel_stride())
+    {
+        for (int y = 0; y < in.size.y; y++) std::memcpy(out.row(y), in.row(y), in.size.x * C * sizeof(T));
+        return;
+    }
+
+    for (int y = 0; y < in.size.y; y++)
+        for (int x = 0; x < in.size.x; x++)
+            for (int c = 0; c < C; c++)
+                out(y, x, c) = in(y, x, c);
+}
+
+// Invokes f(src, dstOffset) for each quadrant of an fftshift: writing every src region at
+// dstOffset moves the zero-frequency bin to the center. Handles odd sizes like numpy's fftshift.
+template <typename T, int C, typename F>
+void for_each_fftshift_quadrant(const image_view<T, C> & v, F f)
+{
+    const int2 lo = v.size - v.size / 2;
+    const int2 hi = v.size / 2;
+
+    const int2 offsets[4][3] = {
+        { { 0, 0 },       lo,                 hi },
+        { { lo.x, 0 },    { hi.x, lo.y },     { 0, hi.y } },
+        { { 0, lo.y },    { lo.x, hi.y },     { hi.x, 0 } },
+        { lo,             hi,                 { 0, 0 } },
+    };
+
+    for (auto & q : offsets)
+    {
+        if (q[1].x > 0 && q[1].y > 0) f(v.subrect(q[0], q[1]), q[2]);
+    }
+}
+
+template <typename T, int C>
+void center_fft_image(const typename non_deduced<image_view<const T, C>>::type & in, const image_view<T, C> & out)
+{
+    assert(in.size == out.size);
+
+    for_each_fftshift_quadrant(in, [&](const image_view<const T, C> & src, const int2 dstOffset)
+    {
+        copy_image<T, C>(src, out.subrect(dstOffset, src.size));
+    });
+}
+
+namespace detail
+{
+    // Source taps and weights of an area-weighted 2:1 reduction along one axis. Even lengths average
+    // pairs; odd lengths 2k+1 -> k spread each output over three taps weighted by their overlap with
+    // the output footprint, so edge texels are neither dropped nor double counted.
+    struct box_taps
+    {
+        int first;
+        int count;
+        float weights[3];
+    };
+
+    inline box_taps box_taps_for(const int inLength, const int i)
+    {
+        if (inLength == 1) return { 0, 1, { 1.0f, 0.0f, 0.0f } };
+        if ((inLength & 1) == 0) return { 2 * i, 2, { 0.5f, 0.5f, 0.0f } };
+        const int k = inLength / 2;
+        const float norm = 1.0f / float(inLength);
+        return { 2 * i, 3, { float(k - i) * norm, float(k) * norm, float(i + 1) * norm } };
+    }
+
+    // out[i] = 0.5 * (in[2i] + in[2i + 1])
+    inline void pair_average_row(const float * in, float * out, const int outLength)
+    {
+        int i = 0;
+#if defined(__AVX2__)
+        const __m256 half = _mm256_set1_ps(0.5f);
+        for (; i + 8 <= outLength; i += 8)
+        {
+            const __m256 sums = _mm256_hadd_ps(_mm256_loadu_ps(in + 2 * i), _mm256_loadu_ps(in + 2 * i + 8));
+            const __m256 ordered = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(sums), _MM_SHUFFLE(3, 1, 2, 0)));
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(ordered, half));
+        }
+#endif
+        for (; i < outLength; ++i) out[i] = 0.5f * (in[2 * i] + in[2 * i + 1]);
+    }
+
+    // out[x] = sum of weights[t] * rows[t][x]
+    inline void weighted_rows(const float * const * rows, const float * weights, const int count, float * out, const int length)
+    {
+        int x = 0;
+#if defined(__AVX2__)
+        for (; x + 8 <= length; x += 8)
+        {
+            __m256 acc = _mm256_mul_ps(_mm256_loadu_ps(rows[0] + x), _mm256_set1_ps(weights[0]));
+            for (int t = 1; t < count; ++t) acc = multiply_add(_mm256_loadu_ps(rows[t] + x), _mm256_set1_ps(weights[t]), acc);
+            _mm256_storeu_ps(out + x, acc);
+        }
+#endif
+        for (; x < length; ++x)
+        {
+            float acc = rows[0][x] * weights[0];
+            for (int t = 1; t < count; ++t) acc += rows[t][x] * weights[t];
+            out[x] = acc;
+        }
+    }
+}
+
+// 2:1 box reduction to max(1, size / 2) on each axis; odd and non-square sizes are area weighted.
+// Each output row blends its two or three source rows into a scratch row, then reduces that row
+// horizontally. Bands of output rows run on separate workers.
+inline void resize_box(const image_view<const float, 1> & in, const image_view<float, 1> & out)
+{
+    assert(out.size.x == std::max(1, in.size.x / 2) && out.size.y == std::max(1, in.size.y / 2));
+
+    scoped_timer timer("resize");
+
+    const bool unitStride = in.stride.x == 1 && out.stride.x == 1;
+    const int minBand = std::max(1, (1 << 16) / std::max(1, in.size.x * 2));
+
+    parallel_for(0, out.size.y, [&](int y0, int y1, int)
+    {
+        std::vector<float> scratch(in.size.x);
+        std::vector<float> packed(unitStride ? 0 : in.size.x * 3);
+
+        for (int y = y0; y < y1; ++y)
+        {
+            const detail::box_taps ty = detail::box_taps_for(in.size.y, y);
+
+            const float * rows[3];
+            for (int t = 0; t < ty.count; ++t)
+            {
+                rows[t] = in.row(ty.first + t);
+                if (!unitStride)
+                {
+                    float * dst = packed.data() + t * in.size.x;
+                    for (int x = 0; x < in.size.x; ++x) dst[x] = rows[t][x * in.stride.x];
+                    rows[t] = dst;
+                }
+            }
+            detail::weighted_rows(rows, ty.weights, ty.count, scratch.data(), in.size.x);
+
+            float * dst = out.row(y);
+            if (unitStride && (in.size.x & 1) == 0)
+            {
+                detail::pair_average_row(scratch.data(), dst, out.size.x);
+                continue;
+            }
+
+            for (int x = 0; x < out.size.x; ++x)
+            {
+                const detail::box_taps tx = detail::box_taps_for(in.size.x, x);
+                float acc = 0.0f;
+                for (int t = 0; t < tx.count; ++t) acc += scratch[tx.first + t] * tx.weights[t];
+                dst[x * out.stride.x] = acc;
+            }
+        }
+    }, minBand);
+}
+
+//////////////////
+//   Channels   //
+//////////////////
+
+// A real channel as a fixed linear combination of RGBA. Luminance, single channels and YCoCg are all
+// linear in the texel, so every decoder produces any of them straight into an FFT input.
+struct channel_weights
+{
+    const char * name;
+    float r, g, b, a;
+
+    float operator() (const float red, const float green, const float blue, const float alpha) const
+    {
+        return r * red + g * green + b * blue + a * alpha;
+    }
+};
+
+static const channel_weights luminance_weights = { "luma", 0.2126f, 0.7152f, 0.0722f, 0.0f };
+
+enum class channel_set { rgba, ycocg };
+
+inline std::vector<channel_weights> channel_set_weights(const channel_set set)
+{
+    if (set == channel_set::ycocg)
+    {
+        return { { "Y", 0.25f, 0.5f, 0.25f, 0.0f }, { "Co", 0.5f, 0.0f, -0.5f, 0.0f }, { "Cg", -0.25f, 0.5f, -0.25f, 0.0f }, { "A", 0.0f, 0.0f, 0.0f, 1.0f } };
+    }
+    return { { "R", 1.0f, 0.0f, 0.0f, 0.0f }, { "G", 0.0f, 1.0f, 0.0f, 0.0f }, { "B", 0.0f, 0.0f, 1.0f, 0.0f }, { "A", 0.0f, 0.0f, 0.0f, 1.0f } };
+}
+
+namespace detail
+{
+    // as_float of every 8-bit value, so the 8-bit path is a table lookup rather than a divide
+    inline const float * unorm8_table()
+    {
+        static const std::vector<float> table = []()
+        {
+            std::vector<float> t(256);
+            for (int i = 0; i < 256; ++i) t[i] = as_float<uint8_t>(uint8_t(i));
+            return t;
+        }();
+        return table.data();
+    }
+
+    inline float sample_to_float(const uint8_t x) { return unorm8_table()[x]; }
+    inline float sample_to_float(const uint16_t x) { return float(x) * (1.0f / 65535.0f); }
+    inline float sample_to_float(const float x) { return x; }
+
+#if defined(__AVX2__)
+    // Eight values to a row with pixel stride 1, or 2 for the real or imaginary parts of a complex
+    // buffer (the masked store leaves the other part untouched)
+    inline void store_strided8(float * dst, const int strideX, const __m256 v)
+    {
+        if (strideX == 1)
+        {
+            _mm256_storeu_ps(dst, v);
+            return;
+        }
+        const __m256 lo = _mm256_unpacklo_ps(v, v), hi = _mm256_unpackhi_ps(v, v);
+        const __m256i even = _mm256_setr_epi32(-1, 0, -1, 0, -1, 0, -1, 0);
+        _mm256_maskstore_ps(dst, even, _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_maskstore_ps(dst + 8, even, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+
+    inline void unpack_bytes(const __m256i v, __m256 rgba[4])
+    {
+        const __m256i mask = _mm256_set1_epi32(0xff);
+        const __m256 scale = _mm256_set1_ps(1.0f / 255.0f);
+        rgba[0] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(v, mask)), scale);
+        rgba[1] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 8), mask)), scale);
+        rgba[2] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 16), mask)), scale);
+        rgba[3] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(v, 24)), scale);
+    }
+
+    // Loads eight interleaved pixels as planar RGBA in [0, 1]. span is how many pixels the load
+    // touches, so rows only take the vector path while that many remain.
+    template <typename T, int C> struct simd_pixels
+    {
+        static const int span = 0;
+        static void load(const T *, __m256 *) { }
+    };
+
+    template <> struct simd_pixels<uint8_t, 4>
+    {
+        static const int span = 8;
+        static void load(const uint8_t * src, __m256 rgba[4]) { unpack_bytes(_mm256_loadu_si256((const __m256i *) src), rgba); }
+    };
+
+    template <> struct simd_pixels<uint8_t, 3>
+    {
+        static const int span = 11;
+        static void load(const uint8_t * src, __m256 rgba[4])
+        {
+            // Move each lane's four pixels (12 bytes) into place, then widen every pixel to a dword
+            const __m256i v = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i *) src), _mm256_setr_epi32(0, 1, 2, 2, 3, 4, 5, 5));
+            const __m256i spread = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+            unpack_bytes(_mm256_shuffle_epi8(v, spread), rgba);
+            rgba[3] = _mm256_set1_ps(1.0f);
+        }
+    };
+
+    template <> struct simd_pixels<uint16_t, 4>
+    {
+        static const int span = 8;
+        static void load(const uint16_t * src, __m256 rgba[4])
+        {
+            // Each pixel is two dwords, RG and BA; gather the RGs and the BAs of eight pixels
+            const __m256i split = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+            const __m256i lo = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i *) src), split);
+            const __m256i hi = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i *) (src + 16)), split);
+            const __m256i rg = _mm256_permute2x128_si256(lo, hi, 0x20), ba = _mm256_permute2x128_si256(lo, hi, 0x31);
+            const __m256i mask = _mm256_set1_epi32(0xffff);
+            const __m256 scale = _mm256_set1_ps(1.0f / 65535.0f);
+            rgba[0] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(rg, mask)), scale);
+            rgba[1] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(rg, 16)), scale);
+            rgba[2] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(ba, mask)), scale);
+            rgba[3] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(ba, 16)), scale);
+        }
+    };
+#endif
+}
+
+// One channel of interleaved 8-bit, 16-bit or float pixels, converted straight to float in the same
+// pass. One and two component images are grey and grey+alpha; images without alpha read as opaque.
+// Rows split across workers, and the common layouts convert eight pixels at a time.
+template <typename T, int C>
+void extract_channel(const image_view<const T, C> & in, const channel_weights & w, const image_view<float, 1> & out)
+{
+    static_assert(C >= 1 && C <= 4, "extract_channel takes one to four components");
+    assert(in.size == out.size);
+
+    scoped_timer timer("convert");
+
+    const int colorChannels = C >= 3 ? 3 : 1;
+    const bool hasAlpha = C == 2 || C == 4;
+
+    parallel_for(0, in.size.y, [&](int y0, int y1, int)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            int x = 0;
+
+#if defined(__AVX2__)
+            const int span = detail::simd_pixels<T, C>::span;
+            if (span && in.stride.x == C && (out.stride.x == 1 || out.stride.x == 2))
+            {
+                const __m256 wr = _mm256_set1_ps(w.r), wg = _mm256_set1_ps(w.g), wb = _mm256_set1_ps(w.b), wa = _mm256_set1_ps(w.a);
+                for (; x + span <= in.size.x; x += 8)
+                {
+                    __m256 rgba[4];
+                    detail::simd_pixels<T, C>::load(&in(y, x, 0), rgba);
+                    const __m256 v = detail::multiply_add(wa, rgba[3], detail::multiply_add(wb, rgba[2], detail::multiply_add(wg, rgba[1], _mm256_mul_ps(wr, rgba[0]))));
+                    detail::store_strided8(&out(y, x), out.stride.x, v);
+                }
+            }
+#endif
+
+            for (; x < in.size.x; ++x)
+            {
+                const float r = detail::sample_to_float(in(y, x, 0));
+                const float g = detail::sample_to_float(in(y, x, colorChannels == 3 ? 1 : 0));
+                const float b = detail::sample_to_float(in(y, x, colorChannels == 3 ? 2 : 0));
+                const float a = hasAlpha ? detail::sample_to_float(in(y, x, C - 1)) : 1.0f;
+                out(y, x) = w(r, g, b, a);
+            }
+        }
+    }, std::max(1, (1 << 16) / std::max(1, in.size.x)));
+}
+
+///////////////////////
+//   Image Pyramid   //
+///////////////////////
+
+// Every level lives in one aligned arena, back to back from the base down to 1x1 (about 4/3 of the
+// base level in total). Each level starts on a cache line, and the whole chain can be written out or
+// cached as a single blob through data() and size_bytes().
+template <typename T, int C>
+class image_buffer_pyramid
+{
+    static const size_t alignment = 64;
+
+    std::vector<int2> sizes;
+    std::vector<size_t> offsets; // in elements of T, from the start of the arena
+    std::unique_ptr<uint8_t[]> storage;
+    tracked_allocation tracked;
+    T * arena = nullptr;
+    size_t totalElements = 0;
+
+    static size_t align_elements(const size_t n)
+    {
+        const size_t perLine = alignment / sizeof(T);
+        return (n + perLine - 1) / perLine * perLine;
+    }
+
+public:
+
+    // maxLevels truncates the chain (e.g. to match a file's authored mips); 0 runs down to 1x1
+    image_buffer_pyramid(const int2 size, const int maxLevels = 0)
+    {
+        for (int2 s = size; ; s = { std::max(1, s.x / 2), std::max(1, s.y / 2) })
+        {
+            sizes.push_back(s);
+            offsets.push_back(totalElements);
+            totalElements += align_elements(size_t(s.x) * s.y * C);
+            if ((s.x == 1 && s.y == 1) || (int) sizes.size() == maxLevels) break;
+        }
+
+        storage.reset(new uint8_t[totalElements * sizeof(T) + alignment]);
+        tracked = tracked_allocation(totalElements * sizeof(T) + alignment);
+        const uintptr_t base = reinterpret_cast<uintptr_t>(storage.get());
+        arena = reinterpret_cast<T *>((base + alignment - 1) & ~uintptr_t(alignment - 1));
+    }
+
+    image_buffer_pyramid(const image_buffer_pyramid &) = delete;
+    image_buffer_pyramid & operator = (const image_buffer_pyramid &) = delete;
+
+    size_t levels() const { return sizes.size(); }
+
+    image_view<T, C> level(const int level)
+    {
+        const size_t l = clamp<size_t>(level, 0, levels() - 1);
+        return image_view<T, C>(arena + offsets[l], sizes[l]);
+    }
+
+    image_view<const T, C> level(const int level) const
+    {
+        const size_t l = clamp<size_t>(level, 0, levels() - 1);
+        return image_view<const T, C>(arena + offsets[l], sizes[l]);
+    }
+
+    T * data() { return arena; }
+    const T * data() const { return arena; }
+    size_t size_bytes() const { return totalElements * sizeof(T); }
+
+    // Fills every level below the base by box filtering the level above it
+    void generate_mips()
+    {
+        for (int l = 1; l < (int) levels(); ++l) resize_box(level(l - 1), level(l));
+    }
+
+};
+
+#endif // end image_hpp
@@ -0,0 +1,180 @@
+#ifndef loader_hpp
+#define loader_hpp
+
+#include <stdint.h>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+#include "util.hpp"
+#include "image.hpp"
+#include "png16.hpp"
+#include "texture_decode.hpp"
+#include "memory.hpp"
+
+///////////////////////
+//   Image Loaders   //
+///////////////////////
+
+// What every loader produces: the size of each mip level, how many images (array layers and cube
+// faces) share that chain, and channel(image, level, weights, out), which writes any channel of any
+// level as planar float into out. out may be an FFT input (see real_view in spectrum.hpp).
+struct loaded_image
+{
+    std::string format;
+    std::vector<int2> levelSizes;
+    int images = 1;
+
+    // True when the file carries its own mip chain rather than a single image to generate mips from
+    bool authoredMips = false;
+
+    std::function<void(int image, int level, const channel_weights & w, const image_view<float, 1> & out)> channel;
+
+    int2 size() const { return levelSizes[0]; }
+    int levels() const { return (int) levelSizes.size(); }
+};
+
+// Pixels at the file's own precision (8-bit, 16-bit or float), kept so any channel can be extracted
+// later without an 8-bit round trip
+struct decoded_pixels
+{
+    enum sample_type { unorm8, unorm16, float32 };
+
+    int2 size;
+    int components;
+    sample_type type;
+    std::shared_ptr<const void> data;
+};
+
+namespace detail
+{
+    template <typename T>
+    void extract_decoded_channel(const decoded_pixels & img, const channel_weights & w, const image_view<float, 1> & out)
+    {
+        const T * data = static_cast<const T *>(img.data.get());
+        switch (img.components)
+        {
+        case 1: extract_channel(image_view<const T, 1>(data, img.size), w, out); break;
+        case 2: extract_channel(image_view<const T, 2>(data, img.size), w, out); break;
+        case 3: extract_channel(image_view<const T, 3>(data, img.size), w, out); break;
+        case 4: extract_channel(image_view<const T, 4>(data, img.size), w, out); break;
+        default: throw std::runtime_error("unsupported number of channels");
+        }
+    }
+
+    // Deinterleaves and converts one channel in a single pass
+    inline void decoded_channel(const decoded_pixels & img, const channel_weights & w, const image_view<float, 1> & out)
+    {
+        switch (img.type)
+        {
+        case decoded_pixels::unorm8: extract_decoded_channel<uint8_t>(img, w, out); break;
+        case decoded_pixels::unorm16: extract_decoded_channel<uint16_t>(img, w, out); break;
+        case decoded_pixels::float32: extract_decoded_channel<float>(img, w, out); break;
+        }
+    }
+
+    inline loaded_image single_image(const char * format, const decoded_pixels & pixels)
+    {
+        loaded_image img;
+        img.format = format;
+        img.levelSizes = { pixels.size };
+        img.channel = [pixels](int, int, const channel_weights & w, const image_view<float, 1> & out) { decoded_channel(pixels, w, out); };
+        return img;
+    }
+
+    template <typename T>
+    decoded_pixels stb_pixels(T * data, const int width, const int height, const int components, const decoded_pixels::sample_type type)
+    {
+        if (!data) throw std::runtime_error(stbi_failure_reason());
+        const size_t bytes = size_t(width) * height * components * sizeof(T);
+        return { { width, height }, components, type, track_shared(std::shared_ptr<const void>(data, [](const void * p) { stbi_image_free((void *) p); }), bytes) };
+    }
+
+    inline loaded_image load_png16(const std::vector<uint8_t> & file)
+    {
+        int width, height, components;
+        auto samples = std::make_shared<std::vector<uint16_t>>(decode_png16(file, width, height, components));
+        return single_image("png (16-bit)", { { width, height }, components, decoded_pixels::unorm16, track_shared(std::shared_ptr<const void>(samples, samples->data()), samples->size() * sizeof(uint16_t)) });
+    }
+
+    inline loaded_image load_stb(const char * format, const std::vector<uint8_t> & file)
+    {
+        int width, height, components;
+        uint8_t * data = stbi_load_from_memory(file.data(), (int) file.size(), &width, &height, &components, 0);
+        return single_image(format, stb_pixels(data, width, height, components, decoded_pixels::unorm8));
+    }
+
+    inline loaded_image load_hdr(const std::vector<uint8_t> & file)
+    {
+        int width, height, components;
+        float * data = stbi_loadf_from_memory(file.data(), (int) file.size(), &width, &height, &components, 0);
+        return single_image("hdr", stb_pixels(data, width, height, components, decoded_pixels::float32));
+    }
+
+    inline loaded_image load_gli(const char * format, const gli::texture & t)
+    {
+        if (t.empty()) throw std::runtime_error("couldn't decode texture");
+        if (!can_decode_texture_format(t.format())) throw std::runtime_error("unsupported compressed format");
+
+        loaded_image img;
+        img.format = format;
+        img.images = (int) texture_images(t);
+        img.authoredMips = true;
+        for (size_t l = 0; l < t.levels(); ++l) img.levelSizes.push_back({ t.extent(l).x, t.extent(l).y });
+        const auto tracked = std::make_shared<tracked_allocation>(t.size());
+        img.channel = [t, tracked](int image, int level, const channel_weights & w, const image_view<float, 1> & out) { texture_level_to_channel(t, level, w, out, image); };
+        return img;
+    }
+
+    inline bool starts_with(const std::vector<uint8_t> & file, const void * magic, const size_t length)
+    {
+        return file.size() >= length && std::memcmp(file.data(), magic, length) == 0;
+    }
+}
+
+// Formats are recognized by their leading bytes rather than the file extension
+struct image_loader
+{
+    const char * name;
+    std::function<bool(const std::vector<uint8_t> &)> matches;
+    std::function<loaded_image(const std::vector<uint8_t> &)> load;
+};
+
+// Tried in order. TGA has no magic number, so it comes last through stb's own header checks, which
+// also pick up the other formats stb reads (BMP, PSD, GIF, PNM).
+inline const std::vector<image_loader> & image_loaders()
+{
+    using namespace detail;
+
+    static const uint8_t png[] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+    static const uint8_t jpeg[] = { 0xFF, 0xD8, 0xFF };
+    static const uint8_t ktx[] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+    static const uint8_t kmg[] = { 0xAB, 'K', 'I', 'M', ' ', '1', '1', 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+    static const std::vector<image_loader> loaders =
+    {
+        { "png (16-bit)", [](const std::vector<uint8_t> & f) { return is_png16(f); }, load_png16 },
+        { "png", [](const std::vector<uint8_t> & f) { return starts_with(f, png, sizeof(png)); }, [](const std::vector<uint8_t> & f) { return load_stb("png", f); } },
+        { "jpeg", [](const std::vector<uint8_t> & f) { return starts_with(f, jpeg, sizeof(jpeg)); }, [](const std::vector<uint8_t> & f) { return load_stb("jpeg", f); } },
+        { "hdr", [](const std::vector<uint8_t> & f) { return stbi_is_hdr_from_memory(f.data(), (int) f.size()) != 0; }, load_hdr },
+        { "dds", [](const std::vector<uint8_t> & f) { return starts_with(f, "DDS ", 4); }, [](const std::vector<uint8_t> & f) { return load_gli("dds", gli::load_dds((const char *) f.data(), f.size())); } },
+        { "ktx", [](const std::vector<uint8_t> & f) { return starts_with(f, ktx, sizeof(ktx)); }, [](const std::vector<uint8_t> & f) { return load_gli("ktx", gli::load_ktx((const char *) f.data(), f.size())); } },
+        { "kmg", [](const std::vector<uint8_t> & f) { return starts_with(f, kmg, sizeof(kmg)); }, [](const std::vector<uint8_t> & f) { return load_gli("kmg", gli::load_kmg((const char *) f.data(), f.size())); } },
+        { "tga and other stb formats", [](const std::vector<uint8_t> & f) { int x, y, c; return stbi_info_from_memory(f.data(), (int) f.size(), &x, &y, &c) != 0; }, [](const std::vector<uint8_t> & f) { return load_stb("tga/other", f); } },
+    };
+    return loaders;
+}
+
+inline loaded_image load_image(const std::vector<uint8_t> & file)
+{
+    scoped_timer timer("decode");
+    for (const auto & loader : image_loaders())
+    {
+        if (loader.matches(file)) return loader.load(file);
+    }
+    throw std::runtime_error("unsupported file format");
+}
+
+#endif // end loader_hpp
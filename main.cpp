@@ -1,13 +1,29 @@
 #include <iostream>
 #include <functional>
 #include <map>
+#include <tuple>
+#include <cmath>
 #include <memory>
 #include <chrono>
+#include <thread>
 #include <vector>
 #include <stdint.h>
 #include <complex>
 #include <type_traits>
 #include "util.hpp"
+#include "image.hpp"
+#include "half.hpp"
+#include "reduce.hpp"
+#include "spectrum.hpp"
+#include "texture_decode.hpp"
+#include "compare.hpp"
+#include "loader.hpp"
+#include "profile.hpp"
+#include "memory.hpp"
+#include "autotune.hpp"
+#include "tiles.hpp"
+#include "display.hpp"
+#include "psd.hpp"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "third-party/stb/stb_image.h"
@@ -15,11 +31,9 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "third-party/stb/stb_image_write.h"
 
-#include "kissfft/kissfft.hpp"
-
 /* todo
- * [ ] image pyramid for mips, generate mips, ui for mips
- * [ ] support rgb textures
+ * [x] image pyramid for mips, generate mips, ui for mips
+ * [x] support rgb textures
  */
 
 inline void draw_text(int x, int y, const char * text)
@@ -36,244 +50,541 @@ class texture_buffer
     GLuint tex;
 public:
     int2 size;
-    texture_buffer() : tex(-1)
+    texture_buffer() : tex(0)
     {
-        if (!tex) glGenTextures(1, &tex);
+        glGenTextures(1, &tex);
         glTextureParameteriEXT(tex, GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTextureParameteriEXT(tex, GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTextureParameteriEXT(tex, GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
         glTextureParameteriEXT(tex, GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
     }
-    ~texture_buffer() { if (tex) glDeleteBuffers(1, &tex); };
+    ~texture_buffer() { if (tex) glDeleteTextures(1, &tex); };
     GLuint handle() const { return tex; }
-};
 
-template <typename T, int C>
-struct image_buffer
-{
-    const int2 size;
-    T * alias;
-    struct delete_array { void operator()(T * p) { delete[] p; } };
-    std::unique_ptr<T, decltype(image_buffer::delete_array())> data;
-    image_buffer() : size({ 0, 0 }) { }
-    image_buffer(const int2 size) : size(size), data(new T[size.x * size.y * C], delete_array()) { alias = data.get(); }
-    image_buffer(const image_buffer<T, C> & r) : size(r.size), data(new T[size.x * size.y * C], delete_array())
-    {
-        alias = data.get();
-        if(r.alias) std::memcpy(alias, r.alias, size.x * size.y * C * sizeof(T));
-    }
-    int size_bytes() const { return C * size.x * size.y * sizeof(T); }
-    int num_pixels() const { return size.x * size.y; }
-    T & operator()(int y, int x) { return alias[y * size.x + x]; }
-    T & operator()(int y, int x, int channel) { return alias[C * (y * size.x + x) + channel]; }
-    T compute_mean() const
-    {
-        T m = 0.0f;
-        for (int x = 0; x < size.x * size.y; ++x) m += alias[x];
-        return m / (size.x * size.y);
-    }
+    texture_buffer(const texture_buffer &) = delete;
+    texture_buffer & operator = (const texture_buffer &) = delete;
 };
 
-inline void upload_png(texture_buffer & buffer, std::vector<uint8_t> & binaryData, bool flip = false)
-{
-    if (flip) stbi_set_flip_vertically_on_load(1);
-    else stbi_set_flip_vertically_on_load(0);
-
-    int width, height, nBytes;
-    auto data = stbi_load_from_memory(binaryData.data(), (int)binaryData.size(), &width, &height, &nBytes, 0);
-
-    switch (nBytes)
-    {
-    case 3: glTextureImage2DEXT(buffer.handle(), GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data); break;
-    case 4: glTextureImage2DEXT(buffer.handle(), GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data); break;
-    default: throw std::runtime_error("unsupported number of channels");
-    }
-    stbi_image_free(data);
-    buffer.size = { width, height };
-}
+// Pixel transfer formats for the luminance element types we upload
+template <typename T> struct luminance_format;
+template <> struct luminance_format<float> { static const GLenum internal = GL_LUMINANCE; static const GLenum type = GL_FLOAT; };
+template <> struct luminance_format<float16> { static const GLenum internal = GL_LUMINANCE16F_ARB; static const GLenum type = GL_HALF_FLOAT; };
 
-inline void upload_dds(texture_buffer & buffer, std::vector<uint8_t> & binaryData)
+// Rows are read in place through GL_UNPACK_ROW_LENGTH, so sub-rectangles upload without a staging copy
+template <typename T>
+void upload_luminance_region(texture_buffer & buffer, const image_view<const T, 1> & imgData, const int2 offset)
 {
-    gli::texture t(gli::load_dds((char *)binaryData.data(), binaryData.size()));
-
-    for (std::size_t l = 0; l < t.levels(); ++l)
+    if (!imgData.has_unit_pixel_stride())
     {
-        GLsizei w = (t.extent(l).x), h = (t.extent(l).y);
-        gli::gl GL(gli::gl::PROFILE_GL33);
-        gli::gl::format const Format = GL.translate(t.format(), t.swizzles());
-        GLenum Target = GL.translate(t.target());
-        glCompressedTextureImage2DEXT(buffer.handle(), Target, GLint(l), Format.Internal, w, h, 0, t.size(l), t.data(0, 0, l));
-        if (l == 0) buffer.size = { w, h };
+        image_buffer<T, 1> packed(imgData.size);
+        copy_image<T, 1>(imgData, packed.view());
+        upload_luminance_region<T>(buffer, packed.view(), offset);
+        return;
     }
-}
-
-image_buffer<float, 1> png_to_luminance(std::vector<uint8_t> & binaryData)
-{
-    int width, height, nBytes;
-    auto data = stbi_load_from_memory(binaryData.data(), (int)binaryData.size(), &width, &height, &nBytes, 0);
- 
-    image_buffer<float, 1> buffer({ width, height });
 
-    for (int y = 0; y < height; y++)
-    {
-        for (int x = 0; x < width; ++x)
-        {
-            const float r = as_float<uint8_t>(data[nBytes * (y * width + x) + 0]);
-            const float g = as_float<uint8_t>(data[nBytes * (y * width + x) + 1]);
-            const float b = as_float<uint8_t>(data[nBytes * (y * width + x) + 2]);
-            buffer(y, x) = to_luminance(r, g, b);
-        }
-    }
-    stbi_image_free(data);
-    return buffer;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, sizeof(T));
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, imgData.stride.y);
+    glTextureSubImage2DEXT(buffer.handle(), GL_TEXTURE_2D, 0, offset.x, offset.y, imgData.size.x, imgData.size.y, GL_LUMINANCE, luminance_format<T>::type, imgData.origin);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 }
 
-void upload_luminance(texture_buffer & buffer, image_buffer<float, 1> & imgData)
+template <typename T>
+void upload_luminance(texture_buffer & buffer, const image_view<const T, 1> & imgData)
 {
-    glTextureImage2DEXT(buffer.handle(), GL_TEXTURE_2D, 0, GL_LUMINANCE, imgData.size.x, imgData.size.y, 0, GL_LUMINANCE, GL_FLOAT, imgData.data.get());
+    glTextureImage2DEXT(buffer.handle(), GL_TEXTURE_2D, 0, luminance_format<T>::internal, imgData.size.x, imgData.size.y, 0, GL_LUMINANCE, luminance_format<T>::type, nullptr);
+    upload_luminance_region<T>(buffer, imgData, { 0, 0 });
 }
 
-void draw_texture_buffer(float rx, float ry, float rw, float rh, const texture_buffer & buffer)
+// (u1, v1) is the far corner of the texture region drawn
+void draw_texture_buffer(float rx, float ry, float rw, float rh, const texture_buffer & buffer, float u1 = 1.0f, float v1 = 1.0f)
 {
     glBindTexture(GL_TEXTURE_2D, buffer.handle());
     glEnable(GL_TEXTURE_2D);
     glBegin(GL_QUADS);
     glTexCoord2f(0, 0); glVertex2f(rx, ry);
-    glTexCoord2f(1, 0); glVertex2f(rx + rw, ry);
-    glTexCoord2f(1, 1); glVertex2f(rx + rw, ry + rh);
-    glTexCoord2f(0, 1); glVertex2f(rx, ry + rh);
+    glTexCoord2f(u1, 0); glVertex2f(rx + rw, ry);
+    glTexCoord2f(u1, v1); glVertex2f(rx + rw, ry + rh);
+    glTexCoord2f(0, v1); glVertex2f(rx, ry + rh);
     glEnd();
     glDisable(GL_TEXTURE_2D);
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-void center_fft_image(image_buffer<float, 1> & in, image_buffer<float, 1> & out)
+// Draws a spectrum at any zoom and pan. The mip-mapped overview texture is always drawn; where the
+// zoom needs more detail than it has, the visible tiles of the matching LOD are drawn over it. Tiles
+// are made and uploaded the first time they are seen, at most a frame budget's worth per frame, and
+// the least recently drawn are dropped past max_tiles. Screen = pan + footprint position * zoom,
+// where the footprint is the area the spectrum covers at zoom 1 (mip levels cover the base's).
+// Textures hold mapped values: a new display mapping remaps the overview and drops the tiles, which
+// are then remade from the raw spectrum like any other.
+class tiled_view
 {
-    assert(in.size == out.size);
+    struct tile
+    {
+        texture_buffer texture;
+        uint64_t lastDrawn = 0;
+        tracked_allocation gpuBytes;
+    };
+
+    std::unique_ptr<spectrum_tiles> tiles;
+    std::unique_ptr<texture_buffer> overview;
+    tracked_allocation overviewBytes, overviewMipBytes;
+    std::map<std::tuple<int, int, int>, std::unique_ptr<tile>> cache;
+    uint64_t frame = 0;
+    bool halfPrecision = false;
+    display_mapping mapping;
+    std::unique_ptr<display_lut> lut;
+
+    // The driver's copy is counted as a "gl texture" allocation
+    tracked_allocation upload(texture_buffer & texture, const image_view<const float, 1> & img) const
+    {
+        scoped_timer timer("upload");
+        memory_stage stage("gl texture");
+        if (halfPrecision)
+        {
+            image_buffer<float16, 1> halfImg(img.size);
+            convert_image(img, halfImg.view());
+            upload_luminance<float16>(texture, halfImg.view());
+            return tracked_allocation(size_t(img.num_pixels()) * sizeof(float16));
+        }
+        upload_luminance<float>(texture, img);
+        return tracked_allocation(size_t(img.num_pixels()) * sizeof(float));
+    }
+
+    void upload_overview()
+    {
+        const image_view<const float, 1> raw = tiles->overview();
+        image_buffer<float, 1> mapped(raw.size);
+        lut->apply(raw, mapped.view());
+
+        overview.reset(new texture_buffer());
+        overviewBytes = upload(*overview, mapped.view());
+        {
+            memory_stage stage("gl texture");
+            overviewMipBytes = tracked_allocation(overviewBytes.size() / 3);
+        }
+        glGenerateTextureMipmapEXT(overview->handle(), GL_TEXTURE_2D);
+        glTextureParameteriEXT(overview->handle(), GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    }
+
+public:
+
+    static const int max_tiles = 256;
+
+    float2 footprint = { 0, 0 };
+    float zoom = 1.0f;
+    float2 pan = { 0, 0 };
+
+    bool empty() const { return !tiles; }
+
+    void clear()
+    {
+        cache.clear();
+        overview.reset();
+        overviewBytes = tracked_allocation();
+        overviewMipBytes = tracked_allocation();
+        tiles.reset();
+        lut.reset();
+    }
+
+    // spectrum is read as tiles are needed, so it must outlive the view or the next set_spectrum
+    void set_spectrum(const image_view<const float, 1> & spectrum, const int2 footprint, const bool halfPrecision, const display_mapping & mapping)
+    {
+        clear();
+        this->footprint = float2(footprint);
+        this->halfPrecision = halfPrecision;
+        tiles.reset(new spectrum_tiles(spectrum));
+        set_mapping(mapping);
+    }
+
+    // Normalizing ranges come from the statistics of the whole spectrum, so tiles and overview agree
+    void set_mapping(const display_mapping & m)
+    {
+        mapping = m;
+        if (!tiles) return;
+        float lo, hi;
+        display_normalization_range(mapping, tiles->stats(), lo, hi);
+        lut.reset(new display_lut(mapping, lo, hi));
+        cache.clear();
+        upload_overview();
+    }
+
+    float2 to_screen(const float2 & p) const { return pan + p * zoom; }
+    float2 to_footprint(const float2 & screen) const { return (screen - pan) / zoom; }
+
+    // Whole footprint in the window, never magnified
+    void fit(const int2 window)
+    {
+        if (footprint.x <= 0 || footprint.y <= 0) return;
+        zoom = std::min(1.0f, std::min(window.x / footprint.x, window.y / footprint.y));
+        pan = { 0, 0 };
+    }
 
-    const int halfWidth = in.size.x / 2;
-    const int halfHeight = in.size.y / 2;
+    // Keeps the footprint point under screen in place
+    void zoom_at(const float2 & screen, const float factor)
+    {
+        const float2 p = to_footprint(screen);
+        zoom = clamp(zoom * factor, 1.0f / 1024.0f, 256.0f);
+        pan = screen - p * zoom;
+    }
 
-    for (int i = 0; i < in.size.y; i++)
+    // Returns true when visible tiles were left for a later frame
+    bool draw(const int2 window, const double budgetMs)
     {
-        for (int j = 0; j < in.size.x; j++)
+        if (!tiles) return false;
+        ++frame;
+
+        const float2 origin = to_screen({ 0, 0 });
+        draw_texture_buffer(origin.x, origin.y, footprint.x * zoom, footprint.y * zoom, *overview);
+
+        // Spectrum bins per screen pixel along the denser axis
+        const float2 binsPerFootprint = float2(tiles->size()) / footprint;
+        const float density = std::max(binsPerFootprint.x, binsPerFootprint.y) / zoom;
+        const int lod = std::max(0, int(std::floor(std::log2(std::max(density, 1.0f)))));
+        if (lod >= tiles->overview_lod()) return false;
+
+        // Visible tiles: screen corners to texels of this LOD
+        const float texelsPerBin = 1.0f / float(1 << lod);
+        const float2 lo = max(to_footprint({ 0, 0 }), float2(0, 0)) * binsPerFootprint * texelsPerBin;
+        const float2 hi = to_footprint(float2(window)) * binsPerFootprint * texelsPerBin;
+        const int2 count = tiles->tile_count(lod);
+        const int2 first = { int(lo.x) / spectrum_tiles::tile_size, int(lo.y) / spectrum_tiles::tile_size };
+        const int2 last = { std::min(count.x - 1, int(hi.x) / spectrum_tiles::tile_size), std::min(count.y - 1, int(hi.y) / spectrum_tiles::tile_size) };
+
+        const auto begin = std::chrono::steady_clock::now();
+        bool pending = false;
+        image_buffer<float, 1> texels({ spectrum_tiles::tile_size, spectrum_tiles::tile_size });
+        for (int ty = first.y; ty <= last.y; ++ty)
         {
-            if (i < halfHeight)
+            for (int tx = first.x; tx <= last.x; ++tx)
             {
-                if (j < halfWidth) out(i, j) = in(i + halfHeight, j + halfWidth);
-                else out(i, j) = in(i + halfWidth, j - halfWidth);
+                const auto key = std::make_tuple(lod, ty, tx);
+                auto it = cache.find(key);
+                if (it == cache.end())
+                {
+                    if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() > budgetMs)
+                    {
+                        pending = true;
+                        continue;
+                    }
+                    it = cache.emplace(key, std::unique_ptr<tile>(new tile())).first;
+                    tiles->fill_tile(lod, { tx, ty }, texels.view());
+                    lut->apply(texels.view(), texels.view());
+                    it->second->gpuBytes = upload(it->second->texture, texels.view());
+                }
+                tile & t = *it->second;
+                t.lastDrawn = frame;
+
+                // Tile corners in the footprint, trimmed to the part inside the image
+                const int2 extent = tiles->tile_extent(lod, { tx, ty });
+                const float2 binSize = float2(float(1 << lod)) / binsPerFootprint;
+                const float2 p0 = to_screen(float2(int2(tx, ty) * spectrum_tiles::tile_size) * binSize);
+                const float2 p1 = to_screen(min(float2(int2(tx, ty) * spectrum_tiles::tile_size + extent) * binSize, footprint));
+                draw_texture_buffer(p0.x, p0.y, p1.x - p0.x, p1.y - p0.y, t.texture, float(extent.x) / spectrum_tiles::tile_size, float(extent.y) / spectrum_tiles::tile_size);
             }
-            else 
+        }
+
+        // Drop the least recently drawn; tiles drawn this frame stay even past the limit
+        while ((int) cache.size() > max_tiles)
+        {
+            auto oldest = cache.end();
+            for (auto it = cache.begin(); it != cache.end(); ++it)
             {
-                if (j < halfWidth) out(i, j) = in(i - halfHeight, j + halfWidth);
-                else out(i, j) = in(i - halfHeight, j - halfWidth);
+                if (oldest == cache.end() || it->second->lastDrawn < oldest->second->lastDrawn) oldest = it;
             }
+            if (oldest->second->lastDrawn == frame) break;
+            cache.erase(oldest);
         }
+
+        return pending;
     }
-}
+};
 
-// In place
-void compute_fft_2d(std::complex<float> * data, const int2 & size, const bool inverse = false) 
+// Radial power against frequency, both log scaled, up to Nyquist, and next to it the angular power
+// as a polar curve (each angle drawn at both ends of its diameter), all normalized to what is drawn
+inline void draw_power_spectrum_profile(const power_spectrum_profile & p, const float x, const float y)
 {
-    const int width = size.x;
-    const int height = size.y;
+    static const float plotWidth = 256, plotHeight = 128, polarSize = 128, gap = 16;
 
-    kissfft<float> xFFT(width, inverse);
-    kissfft<float> yFFT(height, inverse);
+    glColor3f(0.1f, 0.1f, 0.1f);
+    glBegin(GL_QUADS);
+    glVertex2f(x - 4, y - 4); glVertex2f(x + plotWidth + gap + polarSize + 4, y - 4);
+    glVertex2f(x + plotWidth + gap + polarSize + 4, y + plotHeight + 20); glVertex2f(x - 4, y + plotHeight + 20);
+    glEnd();
 
-    std::vector<std::complex<float>> xTmp(std::max(width, height));
-    std::vector<std::complex<float>> yTmp(std::max(width, height));
-    std::vector<std::complex<float>> ySrc(height);
+    const int last = std::min(p.nyquist_bin(), (int) p.radial.size() - 1);
+    double lo = std::numeric_limits<double>::max(), hi = 0.0;
+    for (int b = 1; b <= last; ++b)
+    {
+        if (p.radial[b] <= 0.0) continue;
+        lo = std::min(lo, p.radial[b]);
+        hi = std::max(hi, p.radial[b]);
+    }
 
-    // Compute FFT on X axis
-    for (int y = 0; y < height; ++y)
+    glColor3f(1.0f, 1.0f, 1.0f);
+    if (last >= 2 && hi > 0.0)
     {
-        const std::complex<float> * inputRow = &data[y * width];
-        xFFT.transform(inputRow, xTmp.data());
-        for (int x = 0; x < width; x++) data[y * width + x] = xTmp[x];
+        const double decades = std::max(std::log10(hi / lo), 1e-6);
+        glBegin(GL_LINE_STRIP);
+        for (int b = 1; b <= last; ++b)
+        {
+            if (p.radial[b] <= 0.0) continue;
+            const float u = float(std::log(double(b)) / std::log(double(last)));
+            const float v = float(std::log10(hi / p.radial[b]) / decades);
+            glVertex2f(x + u * plotWidth, y + v * plotHeight);
+        }
+        glEnd();
     }
 
-    // Compute FFT on Y axis
-    for (int x = 0; x < width; x++)
+    double peak = 0.0;
+    for (const double a : p.angular) peak = std::max(peak, a);
+    if (peak > 0.0)
     {
-        // For data locality, create a 1d src "row" out of the Y column
-        for (int y = 0; y < height; y++) ySrc[y] = data[y * width + x];
-        yFFT.transform(ySrc.data(), yTmp.data());
-        for (int y = 0; y < height; y++) data[y * width + x] = yTmp[y];
+        const float cx = x + plotWidth + gap + polarSize * 0.5f, cy = y + polarSize * 0.5f;
+        const int bins = (int) p.angular.size();
+        glBegin(GL_LINE_LOOP);
+        for (int i = 0; i < 2 * bins; ++i)
+        {
+            // Oriented like the centered spectrum: +fx right, +fy down
+            const float r = float(p.angular[i % bins] / peak) * polarSize * 0.5f;
+            const float theta = float(power_spectrum_profile::angle_degrees(i) * 3.14159265358979323846 / 180.0);
+            glVertex2f(cx + r * std::cos(theta), cy + r * std::sin(theta));
+        }
+        glEnd();
     }
+
+    char caption[96];
+    snprintf(caption, sizeof(caption), "radial PSD, %.1f decades", hi > 0.0 ? std::log10(hi / lo) : 0.0);
+    draw_text(int(x), int(y + plotHeight + 14), caption);
+    draw_text(int(x + plotWidth + gap), int(y + plotHeight + 14), "angular  S to hide");
 }
 
 //////////////////////////
 //   Main Application   //
 //////////////////////////
 
-std::unique_ptr<texture_buffer> loadedTexture;
+// Spectra of every image of a file, each mip chain starting at source mip level `level`: a preview
+// while level > 0, the exact result at 0
+struct spectrum_set
+{
+    std::vector<std::unique_ptr<image_buffer_pyramid<float, 1>>> spectra;
+    int level = 0;
+};
+
+// Files with more pixels than this show the spectrum of a mip no larger than previewMaxSize first,
+// then finer ones as they finish in the background (every second mip level, ending at the base)
+static const int64_t progressiveMinPixels = 1 << 20;
+static const int previewMaxSize = 256;
+
 std::unique_ptr<Window> win;
 
-template <typename T, int C>
-class image_buffer_pyramid
+int main(int argc, char * argv[])
 {
-    void build_dimensions(std::vector<int2> & levels, int size)
+    bool should_take_screenshot = false;
+
+    // Upload tiles and the overview as fp16 textures; halves GPU memory and upload bandwidth,
+    // while the CPU-side spectra stay float
+    bool halfPrecisionTextures = false;
+
+    // Derive lower mip spectra by folding the base spectrum rather than running an FFT per level;
+    // the report compares every folded level against the exact per-level FFT
+    bool analyticPyramid = false;
+    bool analyticReport = false;
+
+    // Channels cycled through with C: R, G, B, A or Y, Co, Cg, A
+    channel_set channelSet = channel_set::rgba;
+
+    // Chrome trace_event JSON of every stage and worker band, written on exit
+    std::string tracePath;
+
+    // Stage timings in the corner, toggled with P
+    bool showTimings = true;
+
+    // Hardware counters per stage (Linux perf_event) next to the timings and in the trace
+    bool hardwareCounters = false;
+
+    // FFT strategies measured on this machine (autotune.hpp), read at startup. With --autotune every
+    // dropped file's level sizes are measured first and the wisdom is saved back.
+    std::string wisdomPath;
+    bool autotune = false;
+
+    // Frames are only drawn when something changed; bursts of changes (held keys, results arriving
+    // back to back) are capped at maxFps. Vsync stays on unless --no-vsync.
+    double maxFps = 60.0;
+    bool vsync = true;
+
+    // --psd <out.csv|out.json> followed by image files writes the radial and angular power spectra of
+    // every image's base level and exits without opening a window
+    std::string psdPath;
+    std::vector<std::string> batchFiles;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--fp16") halfPrecisionTextures = true;
+        if (arg == "--analytic") analyticPyramid = true;
+        if (arg == "--analytic-report") analyticPyramid = analyticReport = true;
+        if (arg == "--ycocg") channelSet = channel_set::ycocg;
+        if (arg == "--trace" && i + 1 < argc) tracePath = argv[++i];
+        if (arg == "--counters") hardwareCounters = true;
+        // Large levels take the real in-place FFT once the complex one won't fit the budget, in MB
+        if (arg == "--memory-budget" && i + 1 < argc) memory_budget() = int64_t(std::atoll(argv[++i])) << 20;
+        if (arg == "--wisdom" && i + 1 < argc) wisdomPath = argv[++i];
+        if (arg == "--autotune") autotune = true;
+        if (arg == "--fps" && i + 1 < argc) maxFps = std::max(1.0, std::atof(argv[++i]));
+        if (arg == "--no-vsync") vsync = false;
+        if (arg == "--psd" && i + 1 < argc) psdPath = argv[++i];
+        if (!arg.empty() && arg[0] != '-') batchFiles.push_back(arg);
+    }
+
+    if (!wisdomPath.empty())
     {
-        if (size == 2)
+        try
         {
-            levels.push_back({ 1, 1 });
-            return;
+            std::cout << "Read " << load_fft_wisdom(wisdomPath) << " FFT strategies from " << wisdomPath << std::endl;
+        }
+        catch (const std::exception & e)
+        {
+            std::cout << e.what() << std::endl;
         }
-        levels.push_back({ size, size });
-        build_dimensions(levels, size / 2);
     }
 
-    std::vector<std::shared_ptr<image_buffer<T, C>>> pyramid;
+    // Spectrum of every mip level of every image (array layer, cube face) of the last dropped file,
+    // stepped through with [ and ] for levels and , and . for images
+    std::shared_ptr<const loaded_image> source;
+    std::vector<std::unique_ptr<image_buffer_pyramid<float, 1>>> spectra;
+    int selectedImage = 0;
+    int selectedLevel = 0;
 
-public:
+    // While a large file refines, spectra is a preview whose base is source mip previewLevel; it is
+    // drawn over the full spectraSize footprint. The drop's run stays open until refinement ends.
+    std::unique_ptr<progressive_job<spectrum_set>> refinement;
+    std::unique_ptr<scoped_run> dropRun;
+    int previewLevel = 0;
+    int2 spectraSize;
 
-    image_buffer_pyramid(const int size)
-    {
-        std::vector<int2> levels;
-        build_dimensions(levels, size);
-        for (auto & l : levels) pyramid.emplace_back(std::make_shared<image_buffer<T, C>>(l));
-    }
+    // Per-channel spectra of the selected image's base level, computed the first time one is shown.
+    // selectedChannel -1 is the luminance mip chain above.
+    std::vector<channel_weights> channelWeights;
+    std::vector<image_buffer<float, 1>> channelSpectra;
+    int selectedChannel = -1;
+
+    // Dropping a PNG together with a DDS/KTX compares their base level spectra instead
+    std::unique_ptr<spectrum_pair> comparison;
+    std::unique_ptr<image_buffer<float, 1>> comparisonImage;
+    comparison_mode compareMode = comparison_mode::log_ratio;
+    std::vector<band_energy> comparisonBands;
+    double blockHarmonicGain = 0.0;
+
+    std::string status("No file currently loaded...");
 
-    size_t levels() const { return pyramid.size(); }
+    if (!tracePath.empty()) profiler::instance().enable_trace();
 
-    image_buffer<T, C> & level(const int level)
+    std::string countersStatus;
+    if (hardwareCounters && !profiler::instance().enable_counters(countersStatus))
     {
-        return *pyramid[clamp<size_t>(level, 0, levels() - 1)];
+        countersStatus = "counters unavailable: " + countersStatus;
+        std::cout << countersStatus << std::endl;
     }
 
-};
+    if (!psdPath.empty())
+    {
+        std::vector<named_power_spectrum_profile> profiles;
 
-void resize_box(const image_buffer<float, 1> & in, image_buffer<float, 1> & out)
-{
-    const int w = std::max(1, in.size.x / 2);
-    const int h = std::max(1, in.size.y / 2);
+        // Consecutive same-size layers and files share one packed transform (compute_complex_spectrum_pair).
+        // The luminance of an item still waiting for its partner is held here; an item left without one,
+        // or a pair whose two complex buffers won't fit the memory budget, goes through on its own.
+        std::unique_ptr<image_buffer<float, 1>> pending;
+        std::string pendingPath;
+        int pendingImage = 0;
 
-    if ((in.size.x & 1) == 0 && (in.size.y & 1) == 0)
-    {
-        const float * src = in.alias;
-        float * dst = out.alias;
+        auto profile_magnitudes = [&](const std::string & path, const int image, const complex_buffer & spectrum, const int2 size)
+        {
+            image_buffer<float, 1> magnitudes(size);
+            compute_magnitudes(spectrum.data(), magnitudes.view());
+            profiles.push_back({ path, image, compute_power_spectrum_profile(magnitudes.view()) });
+        };
 
-        for (int y = 0; y < h; y++)
+        auto flush_pending = [&]()
         {
-            for (int x = 0; x < w; x++)
+            if (!pending) return;
+            image_buffer<float, 1> magnitudes(pending->size);
+            compute_budgeted_magnitude_spectrum(pending->size, [&](const image_view<float, 1> & fftInput)
             {
-                *dst = 0.25f * (src[0] + src[1] + src[in.size.x] + src[in.size.x + 1]);
-                dst++;
-                src += 2;
-            }
-            src += in.size.x;
-        }
-    }
-}
+                copy_image<float, 1>(pending->view(), fftInput);
+            }, magnitudes.view());
+            profiles.push_back({ pendingPath, pendingImage, compute_power_spectrum_profile(magnitudes.view()) });
+            pending.reset();
+        };
 
-int main(int argc, char * argv[])
-{
-    bool should_take_screenshot = false;
+        for (const std::string & path : batchFiles)
+        {
+            scoped_run run;
+            try
+            {
+                const std::vector<uint8_t> bytes = read_file_binary(path);
+                const loaded_image file = load_image(bytes);
+                const int2 size = file.size();
+                const int64_t complexBytes = int64_t(size.x) * size.y * sizeof(std::complex<float>);
 
-    image_buffer_pyramid<float, 1> pyramid(512);
+                for (int i = 0; i < file.images; ++i)
+                {
+                    auto fill = [&](const image_view<float, 1> & fftInput) { file.channel(i, 0, luminance_weights, fftInput); };
 
-    std::string status("No file currently loaded...");
+                    if (pending && pending->size != size) flush_pending();
+                    if (!fits_memory_budget(2 * complexBytes))
+                    {
+                        flush_pending();
+                        image_buffer<float, 1> magnitudes(size);
+                        compute_budgeted_magnitude_spectrum(size, fill, magnitudes.view());
+                        profiles.push_back({ path, i, compute_power_spectrum_profile(magnitudes.view()) });
+                    }
+                    else if (pending)
+                    {
+                        fft_plan_2d plan(size);
+                        complex_buffer a, b;
+                        std::tie(a, b) = compute_complex_spectrum_pair(plan, [&](const image_view<float, 1> & fftInput)
+                        {
+                            copy_image<float, 1>(pending->view(), fftInput);
+                        }, fill);
+                        pending.reset();
+                        profile_magnitudes(pendingPath, pendingImage, a, size);
+                        profile_magnitudes(path, i, b, size);
+                    }
+                    else
+                    {
+                        pending.reset(new image_buffer<float, 1>(size));
+                        fill(pending->view());
+                        pendingPath = path;
+                        pendingImage = i;
+                    }
+                }
+            }
+            catch (const std::exception & e)
+            {
+                std::cout << "Couldn't load " << path << ": " << e.what() << std::endl;
+            }
+        }
+        try
+        {
+            scoped_run run;
+            flush_pending();
+        }
+        catch (const std::exception & e)
+        {
+            std::cout << "Couldn't profile " << pendingPath << ": " << e.what() << std::endl;
+        }
+
+        if (!tracePath.empty() && !profiler::instance().write_trace(tracePath)) std::cout << "Couldn't write trace to " << tracePath << std::endl;
+        if (!save_power_spectrum_profiles(psdPath, profiles))
+        {
+            std::cout << "Couldn't write " << psdPath << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "Wrote " << profiles.size() << " power spectrum profiles to " << psdPath << std::endl;
+        return EXIT_SUCCESS;
+    }
 
     try
     {
@@ -284,97 +595,443 @@ int main(int argc, char * argv[])
         std::cout << "Caught GLFW window exception: " << e.what() << std::endl;
     }
 
+    // Zoomed with the scroll wheel, panned by dragging, F to fit. Dropping a file fits it again.
+    tiled_view view;
+    bool fitView = true;
+    bool dragging = false;
+    float2 dragFrom;
+
+    // How magnitudes become grey levels: M cycles linear/log/dB, N switches between min/max and
+    // 1st-99.9th percentile normalization, G and Shift+G double and halve the gain, Y and Shift+Y
+    // raise and lower gamma, B/W and Shift+B/W move the black and white clip points, R resets. Only
+    // the textures are remade; the spectra stay as computed.
+    display_mapping mapping;
+
+    // Log ratio comparisons are already grey levels
+    auto current_mapping = [&]()
+    {
+        if (!comparison || compareMode != comparison_mode::log_ratio) return mapping;
+        display_mapping identity;
+        identity.normalize = false;
+        identity.gain = 1.0f;
+        return identity;
+    };
+
+    // Radial and angular power spectrum of what is shown, toggled with S and computed the first time
+    // it is drawn. Not for log ratio comparisons, which aren't magnitudes.
+    bool showProfile = false;
+    image_view<const float, 1> shownSpectrum(nullptr, { 0, 0 });
+    std::unique_ptr<power_spectrum_profile> shownProfile;
+
+    auto upload_spectrum = [&](const image_view<const float, 1> & spectrum, const int2 footprint)
+    {
+        view.set_spectrum(spectrum, footprint, halfPrecisionTextures, current_mapping());
+        shownSpectrum = spectrum;
+        shownProfile.reset();
+    };
+
+    auto change_mapping = [&](const display_mapping & m)
+    {
+        mapping = m;
+        mapping.gain = clamp(mapping.gain, 1.0f / 1024.0f, 65536.0f);
+        mapping.gamma = clamp(mapping.gamma, 0.1f, 10.0f);
+        mapping.clipLow = clamp(mapping.clipLow, 0.0f, 0.95f);
+        mapping.clipHigh = clamp(mapping.clipHigh, mapping.clipLow + 0.05f, 1.0f);
+        view.set_mapping(current_mapping());
+    };
+
+    auto show_level = [&](const int level)
+    {
+        if (spectra.empty()) return;
+        const image_buffer_pyramid<float, 1> & chain = *spectra[selectedImage];
+        selectedLevel = clamp<int>(level, 0, (int) chain.levels() - 1);
+        selectedChannel = -1;
+
+        // Every level is stretched over the base level's footprint so aliasing lines up across mips
+        upload_spectrum(chain.level(selectedLevel), spectraSize);
+    };
+
+    auto show_image = [&](const int image)
+    {
+        if (spectra.empty()) return;
+        const int clamped = clamp<int>(image, 0, (int) spectra.size() - 1);
+        if (clamped != selectedImage) channelSpectra.clear();
+        selectedImage = clamped;
+        show_level(selectedLevel);
+    };
+
+    auto show_channel = [&](const int channel)
+    {
+        if (spectra.empty() || !source) return;
+        if (channel < 0) return show_level(0);
+
+        const int2 size = source->size();
+        if (channelSpectra.empty())
+        {
+            channelWeights = channel_set_weights(channelSet);
+            const auto complexSpectra = compute_channel_spectra(size, (int) channelWeights.size(), [&](const int c, const image_view<float, 1> & fftInput)
+            {
+                source->channel(selectedImage, 0, channelWeights[c], fftInput);
+            });
+            for (const auto & s : complexSpectra)
+            {
+                channelSpectra.emplace_back(size);
+                compute_magnitudes(s.data(), channelSpectra.back().view());
+            }
+        }
+
+        // Stepping past the last channel goes back to luma
+        if (channel >= (int) channelSpectra.size()) return show_level(0);
+
+        selectedChannel = channel;
+        upload_spectrum(channelSpectra[selectedChannel].view(), size);
+    };
+
+    auto show_comparison = [&]()
+    {
+        if (!comparison) return;
+        comparisonImage.reset(new image_buffer<float, 1>(comparison->size));
+        compute_comparison_image(*comparison, compareMode, comparisonImage->view());
+        upload_spectrum(comparisonImage->view(), comparison->size);
+    };
+
+    // Up to maxWindowSize; larger spectra start zoomed out to fit
+    auto grow_window = [&](const int2 size)
+    {
+        static const int maxWindowSize = 1024;
+        int2 existingWindowSize = win->get_window_size();
+        int2 newWindowSize = int2(std::max(existingWindowSize.x, std::min(size.x, maxWindowSize)), std::max(existingWindowSize.y, std::min(size.y, maxWindowSize)));
+        win->set_window_size(newWindowSize);
+        fitView = true;
+    };
+
+    // A is the source image, B the compressed texture made from it
+    auto load_comparison = [&](const loaded_image & a, const loaded_image & b)
+    {
+        try
+        {
+            if (a.size() != b.size()) throw std::runtime_error("sizes differ");
+
+            grow_window(a.size());
+
+            comparison.reset(new spectrum_pair(compute_spectrum_pair(a.size(),
+                [&](const image_view<float, 1> & fftInput) { a.channel(0, 0, luminance_weights, fftInput); },
+                [&](const image_view<float, 1> & fftInput) { b.channel(0, 0, luminance_weights, fftInput); })));
+            comparisonBands = compare_band_energy(*comparison);
+            blockHarmonicGain = block_harmonic_gain(*comparison);
+
+            for (const auto & b : comparisonBands)
+            {
+                std::cout << "band " << b.lower << "-" << b.upper << " cycles/px energy loss: " << b.loss() * 100.0 << "%" << std::endl;
+            }
+            std::cout << "4x4 block grid harmonic gain: " << blockHarmonicGain << std::endl;
+
+            show_comparison();
+        }
+        catch (const std::exception & e)
+        {
+            comparison.reset();
+            status = std::string("Couldn't compare: ") + e.what();
+        }
+    };
+
     win->on_key = [&](int key, int action, int mods)
     {
+        // Keys pressed while a drop is still refining count toward its run
+        std::unique_ptr<scoped_run> run(dropRun ? nullptr : new scoped_run());
+        if (key == GLFW_KEY_P && action == GLFW_RELEASE) showTimings = !showTimings;
+        if (key == GLFW_KEY_S && action == GLFW_RELEASE) showProfile = !showProfile;
         if (key == ' ' && action == GLFW_RELEASE) should_take_screenshot = true;
+        if (key == GLFW_KEY_F && action == GLFW_RELEASE) fitView = true;
+        if (key == GLFW_KEY_LEFT_BRACKET && action != GLFW_RELEASE) show_level(selectedLevel - 1);
+        if (key == GLFW_KEY_RIGHT_BRACKET && action != GLFW_RELEASE) show_level(selectedLevel + 1);
+        if (key == GLFW_KEY_COMMA && action != GLFW_RELEASE) show_image(selectedImage - 1);
+        if (key == GLFW_KEY_PERIOD && action != GLFW_RELEASE) show_image(selectedImage + 1);
+        if (key == GLFW_KEY_C && action == GLFW_RELEASE) show_channel(selectedChannel + 1);
+        if (key == GLFW_KEY_D && action == GLFW_RELEASE && comparison)
+        {
+            compareMode = compareMode == comparison_mode::log_ratio ? comparison_mode::difference : comparison_mode::log_ratio;
+            show_comparison();
+        }
+
+        const bool shift = (mods & GLFW_MOD_SHIFT) != 0;
+        display_mapping m = mapping;
+        if (key == GLFW_KEY_M && action == GLFW_RELEASE) m.scale = display_scale((int(m.scale) + 1) % 3);
+        else if (key == GLFW_KEY_N && action == GLFW_RELEASE) m.range = m.range == display_range::min_max ? display_range::percentile : display_range::min_max;
+        else if (key == GLFW_KEY_G && action != GLFW_RELEASE) m.gain *= shift ? 0.5f : 2.0f;
+        else if (key == GLFW_KEY_Y && action != GLFW_RELEASE) m.gamma *= shift ? 1.0f / 1.25f : 1.25f;
+        else if (key == GLFW_KEY_B && action != GLFW_RELEASE) m.clipLow += shift ? -0.05f : 0.05f;
+        else if (key == GLFW_KEY_W && action != GLFW_RELEASE) m.clipHigh += shift ? 0.05f : -0.05f;
+        else if (key == GLFW_KEY_R && action == GLFW_RELEASE) m = display_mapping();
+        else return;
+
+        if (key == GLFW_KEY_M || key == GLFW_KEY_N) m.gain = display_mapping::default_gain(m.scale, m.range);
+        change_mapping(m);
     };
 
-    win->on_drop = [&](int numFiles, const char ** paths)
+    win->on_scroll = [&](const float2 offset)
+    {
+        view.zoom_at(win->get_cursor_pos(), std::pow(1.25f, offset.y));
+    };
+
+    win->on_mouse_button = [&](int button, int action, int)
     {
+        if (button != GLFW_MOUSE_BUTTON_LEFT) return;
+        dragging = action == GLFW_PRESS;
+        dragFrom = win->get_cursor_pos();
+    };
+
+    win->on_cursor_pos = [&](const float2 pos)
+    {
+        if (!dragging) return;
+        view.pan += pos - dragFrom;
+        dragFrom = pos;
+        win->request_redraw();
+    };
+
+    // Swaps in a finer set of spectra, keeping the view on the same source mip
+    auto show_spectrum_set = [&](spectrum_set & set)
+    {
+        const int sourceLevel = previewLevel + selectedLevel;
+        spectra = std::move(set.spectra);
+        previewLevel = set.level;
+        selectedLevel = std::max(0, sourceLevel - previewLevel);
+        if (selectedChannel < 0) show_level(selectedLevel);
+    };
+
+    auto load_files = [&](int numFiles, const char ** paths)
+    {
+        comparison.reset();
+        source.reset();
+        spectra.clear();
+        channelSpectra.clear();
+        selectedImage = selectedLevel = previewLevel = 0;
+        selectedChannel = -1;
+        comparisonImage.reset();
+        view.clear();
+        shownSpectrum = image_view<const float, 1>(nullptr, { 0, 0 });
+        shownProfile.reset();
+
+        // Formats are recognized by content, so the extension doesn't matter
+        std::vector<loaded_image> files;
         for (int f = 0; f < numFiles; f++)
         {
-            std::vector<uint8_t> data;
-            loadedTexture.reset(new texture_buffer()); // gen handle
-            const std::string fileExtension = get_extension(paths[f]);
             status = paths[f];
 
             try
             {
-                data = read_file_binary(std::string(paths[f]));
+                std::vector<uint8_t> bytes;
+                tracked_allocation trackedBytes;
+                {
+                    scoped_timer timer("read");
+                    bytes = read_file_binary(std::string(paths[f]));
+                    trackedBytes = tracked_allocation(bytes.size());
+                }
+                files.push_back(load_image(bytes));
             }
             catch (const std::exception & e)
             {
-                status = std::string("Couldn't read file: ") + e.what();
+                status = std::string("Couldn't load ") + paths[f] + ": " + e.what();
+                return;
             }
+        }
 
-            if (fileExtension == "png" || fileExtension == "PNG")
-            {
-                auto img = png_to_luminance(data);
+        // An image dropped together with a texture (authored mips) compares their base level spectra
+        if (files.size() == 2 && files[0].authoredMips != files[1].authoredMips)
+        {
+            const int a = files[0].authoredMips ? 1 : 0;
+            status = std::string(paths[a]) + " vs " + paths[1 - a];
+            load_comparison(files[a], files[1 - a]);
+            return;
+        }
 
-                if (!is_power_of_two(img.size.x) || !is_power_of_two(img.size.y))
-                {
-                    status = "Image size is not a power of two";
-                    return;
-                }
+        // Otherwise the last file wins
+        const loaded_image & file = files.back();
+        status += " (" + file.format + ")";
 
-                // Resize window
-                int2 existingWindowSize = win->get_window_size();
-                int2 newWindowSize = int2(std::max(existingWindowSize.x, img.size.x), std::max(existingWindowSize.y, img.size.y));
-                win->set_window_size(newWindowSize);
+        grow_window(file.size());
 
-                float mean = img.compute_mean();
-                std::vector<std::complex<float>>imgAsComplexArray(img.size.x * img.size.y);
+        if (autotune)
+        {
+            scoped_timer timer("autotune");
+            std::vector<int2> sizes = file.levelSizes;
+            if (!file.authoredMips)
+            {
+                for (int2 s = file.size(); s.x > 1 || s.y > 1; ) sizes.push_back(s = { std::max(1, s.x / 2), std::max(1, s.y / 2) });
+            }
+            for (const int2 & s : sizes)
+            {
+                autotune_fft(s, fft_kind::complex);
+                if (can_real_fft_2d(s)) autotune_fft(s, fft_kind::real);
+            }
+            if (!wisdomPath.empty() && !save_fft_wisdom(wisdomPath)) std::cout << "Couldn't write " << wisdomPath << std::endl;
+        }
 
-                for (int y = 0; y < img.size.y; y++)
-                    for (int x = 0; x < img.size.x; x++)
-                        imgAsComplexArray[y * img.size.x + x] = img(y, x) - mean;
+        spectraSize = file.size();
 
-                compute_fft_2d(imgAsComplexArray.data(), img.size);
+        // Mips to transform for a single image; textures transform the mips stored in the file
+        // rather than ones we generate, for every layer and face
+        std::shared_ptr<image_buffer_pyramid<float, 1>> mips;
+        if (!file.authoredMips)
+        {
+            image_buffer<float, 1> img(file.size());
+            file.channel(0, 0, luminance_weights, img.view());
 
-                float min = std::abs(imgAsComplexArray[0]), max = min;
-                for (int i = 0; i < img.size.x * img.size.y; i++) 
+            if (analyticPyramid)
+            {
+                if (!can_fold_spectrum(img.size))
                 {
-                    float value = std::abs(imgAsComplexArray[i]);
-                    min = std::min(min, value);
-                    max = std::max(max, value);
+                    status = "Analytic pyramid needs power-of-two image sizes";
+                    return;
                 }
 
-                // Convert back to image type & normalize range
-                for (int y = 0; y < img.size.y; y++)
+                spectra.emplace_back(new image_buffer_pyramid<float, 1>(img.size));
+                image_buffer_pyramid<float, 1> & chain = *spectra.back();
+                compute_analytic_pyramid_spectra(img.view(), chain);
+
+                if (analyticReport)
                 {
-                    for (int x = 0; x < img.size.x; x++)
+                    image_buffer_pyramid<float, 1> exactMips(img.size);
+                    copy_image<float, 1>(img.view(), exactMips.level(0));
+                    exactMips.generate_mips();
+
+                    double worst = 0.0;
+                    const std::vector<double> errors = analytic_pyramid_error(exactMips);
+                    for (size_t l = 0; l < errors.size(); ++l)
                     {
-                        const auto v = imgAsComplexArray[y * img.size.x + x];
-                        img(y, x) = ((std::sqrt((v.real() * v.real()) + (v.imag() * v.imag())) - min) / (max - min)) * 64.f;
+                        std::cout << "analytic mip " << l << " relative rms error: " << errors[l] << std::endl;
+                        worst = std::max(worst, errors[l]);
                     }
+                    char worstText[32];
+                    snprintf(worstText, sizeof(worstText), "%.2e", worst);
+                    status += std::string(" (analytic, worst relative error ") + worstText + ")";
                 }
 
-                // Move zero-frequency to the center
-                image_buffer<float, 1> centered(img.size);
-                center_fft_image(img, centered);
-
-                loadedTexture->size = { img.size.x, img.size.y };
-                upload_luminance(*loadedTexture.get(), centered);
+                source = std::make_shared<const loaded_image>(file);
+                show_level(0);
+                return;
             }
-            else if (fileExtension == "dds")
+
+            mips = std::make_shared<image_buffer_pyramid<float, 1>>(img.size);
+            copy_image<float, 1>(img.view(), mips->level(0));
+            mips->generate_mips();
+        }
+
+        // Spectra of every image's chain from source mip `from` down. Blocks decode straight into each
+        // level's FFT input, and the small levels of all images decode and transform in parallel.
+        // check(), when given, runs before every level and may throw to abandon the set.
+        auto spectra_from = [mips, file](const int from, const std::function<void()> & check)
+        {
+            std::unique_ptr<spectrum_set> set(new spectrum_set());
+            set->level = from;
+            const int2 size = mips ? mips->level(from).size : file.levelSizes[from];
+            const int levels = mips ? 0 : file.levels() - from;
+            for (int i = 0; i < file.images; ++i) set->spectra.emplace_back(new image_buffer_pyramid<float, 1>(size, levels));
+            compute_layered_pyramid_spectra(file.images, [&](const int image) -> image_buffer_pyramid<float, 1> & { return *set->spectra[image]; },
+                [&](const int image, const int level, const image_view<float, 1> & fftInput)
             {
-                upload_dds(*loadedTexture.get(), data);
-            }
-            else
+                if (check) check();
+                if (mips) copy_image<float, 1>(mips->level(from + level), fftInput);
+                else file.channel(image, from + level, luminance_weights, fftInput);
+            });
+            return set;
+        };
+
+        const int levels = mips ? (int) mips->levels() : file.levels();
+        auto level_size = [&](const int l) { return mips ? mips->level(l).size : file.levelSizes[l]; };
+
+        int preview = 0;
+        if (int64_t(file.size().x) * file.size().y > progressiveMinPixels)
+        {
+            while (preview + 1 < levels && std::max(level_size(preview).x, level_size(preview).y) > previewMaxSize) ++preview;
+        }
+
+        try
+        {
+            std::unique_ptr<spectrum_set> first = spectra_from(preview, nullptr);
+            show_spectrum_set(*first);
+        }
+        catch (const std::exception & e)
+        {
+            spectra.clear();
+            status = std::string("Couldn't compute spectra: ") + e.what();
+            return;
+        }
+
+        source = std::make_shared<const loaded_image>(file);
+
+        // The rest runs in the background; the loop swaps each finer set in as it arrives
+        if (preview > 0)
+        {
+            refinement.reset(new progressive_job<spectrum_set>([spectra_from, preview](progressive_job<spectrum_set> & job)
             {
-                status = "Unsupported file format";
-            }
+                // A new drop cancels between levels, so it waits for one level's transform at most
+                for (int from = std::max(0, preview - 2); !job.cancelled(); from = std::max(0, from - 2))
+                {
+                    job.publish(spectra_from(from, [&job]() { job.throw_if_cancelled(); }));
+                    if (from == 0) break;
+                }
+            }, []() { win->request_redraw(); }));
+        }
+    };
+
+    // Closes the drop's run once its spectra are final
+    auto finish_drop = [&]()
+    {
+        dropRun.reset();
+
+        // Per-file memory log, for tracking down what an out-of-memory drop was holding
+        const double mb = 1.0 / (1 << 20);
+        std::cout << status << ": peak " << profiler::instance().last_run_peak_bytes() * mb << " MB, live " << profiler::instance().live_bytes() * mb << " MB" << std::endl;
+        for (const auto & s : profiler::instance().stats())
+        {
+            if (s.lastAllocated > 0) std::cout << "  " << s.name << ": allocated " << s.lastAllocated * mb << " MB, peak " << s.lastPeak * mb << " MB" << std::endl;
         }
     };
 
-    auto t0 = std::chrono::high_resolution_clock::now();
+    win->on_drop = [&](int numFiles, const char ** paths)
+    {
+        // A new drop cancels the previous refinement, waiting for the level it is on
+        refinement.reset();
+        dropRun.reset(new scoped_run());
+        load_files(numFiles, paths);
+        if (!refinement) finish_drop();
+    };
+
+    win->set_vsync(vsync);
+
+    typedef std::chrono::steady_clock frame_clock;
+    const auto frameInterval = std::chrono::duration_cast<frame_clock::duration>(std::chrono::duration<double>(1.0 / maxFps));
+    auto lastFrame = frame_clock::now() - frameInterval;
+    float drawMs = 0.0f;
+
     while (!win->should_close())
     {
-        glfwPollEvents();
+        // Idle: sleep in the event queue, leaving the cores to the FFT workers
+        win->wait_events(!win->redraw_requested());
+
+        if (refinement)
+        {
+            if (std::unique_ptr<spectrum_set> finer = refinement->take()) show_spectrum_set(*finer);
+            if (refinement->done())
+            {
+                const std::string error = refinement->error();
+                if (!error.empty()) status = "Couldn't refine: " + error;
+                refinement.reset();
+                finish_drop();
+            }
+        }
 
-        auto t1 = std::chrono::high_resolution_clock::now();
-        float timestep = std::chrono::duration<float>(t1 - t0).count();
-        t0 = t1;
+        if (!win->redraw_requested()) continue;
+
+        // Frame cap: let further requests pile into this frame
+        if (frame_clock::now() < lastFrame + frameInterval)
+        {
+            std::this_thread::sleep_until(lastFrame + frameInterval);
+            win->wait_events(false);
+        }
+        win->clear_redraw_request();
+        lastFrame = frame_clock::now();
 
         auto windowSize = win->get_window_size();
         glViewport(0, 0, windowSize.x, windowSize.y);
@@ -384,21 +1041,147 @@ int main(int argc, char * argv[])
 
         glOrtho(0, windowSize.x, windowSize.y, 0, -1, +1);
 
-        if (loadedTexture.get())
+        if (fitView)
         {
-            draw_texture_buffer(0, 0, loadedTexture->size.x, loadedTexture->size.y, *loadedTexture.get());
+            view.fit(windowSize);
+            fitView = false;
         }
 
+        // Tiles that didn't fit this frame's budget are made in the next ones
+        static const double tileBudgetMs = 8.0;
+        if (view.draw(windowSize, tileBudgetMs)) win->request_redraw();
+
         if (should_take_screenshot)
         {
-            should_take_screenshot = take_screenshot(loadedTexture->size);
+            should_take_screenshot = take_screenshot(win->get_framebuffer_size());
         }
 
         draw_text(10, 16, status.c_str());
 
+        if (!spectra.empty() && selectedChannel >= 0)
+        {
+            const std::string channelStatus = std::string("channel ") + channelWeights[selectedChannel].name + " (base level)  C to cycle channels";
+            draw_text(10, 32, channelStatus.c_str());
+        }
+        else if (!spectra.empty())
+        {
+            const image_buffer_pyramid<float, 1> & chain = *spectra[selectedImage];
+            const int2 levelSize = chain.level(selectedLevel).size;
+            std::string mipStatus = "mip " + std::to_string(previewLevel + selectedLevel) + "/" + std::to_string(previewLevel + chain.levels() - 1) + " (" + std::to_string(levelSize.x) + "x" + std::to_string(levelSize.y) + ")  [ and ] to step, C for channels";
+            if (spectra.size() > 1) mipStatus += "  image " + std::to_string(selectedImage) + "/" + std::to_string(spectra.size() - 1) + " , and . to step";
+            draw_text(10, 32, mipStatus.c_str());
+
+            if (previewLevel > 0)
+            {
+                const int2 previewSize = chain.level(0).size;
+                char previewStatus[128];
+                snprintf(previewStatus, sizeof(previewStatus), "low-frequency preview from %dx%d of %dx%d, refining...", previewSize.x, previewSize.y, spectraSize.x, spectraSize.y);
+                draw_text(10, 48, previewStatus);
+            }
+        }
+
+        if (comparison && !view.empty())
+        {
+            // Outline the 4x4 block grid harmonics at their centered positions
+            const float2 scale = view.footprint / float2(comparison->size);
+            glColor3f(1.0f, 0.3f, 0.2f);
+            for (const int2 & bin : block_grid_harmonics(comparison->size))
+            {
+                const float2 c = view.to_screen(float2(((bin.x + comparison->size.x / 2) % comparison->size.x + 0.5f) * scale.x, ((bin.y + comparison->size.y / 2) % comparison->size.y + 0.5f) * scale.y));
+                const float cx = c.x, cy = c.y;
+                glBegin(GL_LINE_LOOP);
+                glVertex2f(cx - 4, cy - 4); glVertex2f(cx + 4, cy - 4); glVertex2f(cx + 4, cy + 4); glVertex2f(cx - 4, cy + 4);
+                glEnd();
+            }
+            glColor3f(1.0f, 1.0f, 1.0f);
+
+            const std::string modeStatus = std::string(compareMode == comparison_mode::log_ratio ? "log ratio B/A" : "difference |B - A|") + "  D to toggle";
+            draw_text(10, 32, modeStatus.c_str());
+
+            int y = 48;
+            for (const auto & b : comparisonBands)
+            {
+                char line[96];
+                snprintf(line, sizeof(line), "%.4f-%.4f cycles/px: %+.1f%% energy lost", b.lower, b.upper, b.loss() * 100.0);
+                draw_text(10, y, line);
+                y += 16;
+            }
+
+            char gainLine[64];
+            snprintf(gainLine, sizeof(gainLine), "4x4 block grid harmonics: %.2fx energy", blockHarmonicGain);
+            draw_text(10, y, gainLine);
+        }
+
+        if (!view.empty())
+        {
+            const display_mapping shown = current_mapping();
+            char mappingLine[160];
+            if (shown.normalize) snprintf(mappingLine, sizeof(mappingLine), "%s %s  gain %g  gamma %.2f  clip %.2f-%.2f  M N G Y B W R to change, S for PSD", display_mapping::scale_name(shown.scale),
+                shown.range == display_range::percentile ? "p1-p99.9" : "min-max", shown.gain, shown.gamma, shown.clipLow, shown.clipHigh);
+            else snprintf(mappingLine, sizeof(mappingLine), "log ratio shown as is");
+            draw_text(10, windowSize.y - 8, mappingLine);
+        }
+
+        if (showProfile && !view.empty() && current_mapping().normalize)
+        {
+            if (!shownProfile)
+            {
+                std::unique_ptr<scoped_run> run(dropRun ? nullptr : new scoped_run());
+                shownProfile.reset(new power_spectrum_profile(compute_power_spectrum_profile(shownSpectrum)));
+            }
+            draw_power_spectrum_profile(*shownProfile, float(windowSize.x - 410), 10.0f);
+        }
+
+        if (showTimings)
+        {
+            const std::vector<profiler::stage_stats> stages = profiler::instance().stats();
+
+            int y = windowSize.y - 8 - 16 * int(stages.size() + (countersStatus.empty() ? 2 : 3));
+            char line[256];
+            snprintf(line, sizeof(line), "draw %.1f ms  last run %.1f ms  (P to hide)", drawMs, profiler::instance().last_run_ms());
+            draw_text(10, y, line);
+
+            const double mb = 1.0 / (1 << 20);
+            y += 16;
+            const int length = snprintf(line, sizeof(line), "memory live %.1f MB  last run peak %.1f MB", profiler::instance().live_bytes() * mb, profiler::instance().last_run_peak_bytes() * mb);
+            if (memory_budget() > 0) snprintf(line + length, sizeof(line) - length, "  budget %.0f MB", memory_budget() * mb);
+            draw_text(10, y, line);
+
+            if (!countersStatus.empty())
+            {
+                y += 16;
+                draw_text(10, y, countersStatus.c_str());
+            }
+
+            // Counts of the last run in millions
+            auto millions = [](const int64_t v) { return v >= 0 ? double(v) * 1e-6 : -1.0; };
+
+            for (const auto & s : stages)
+            {
+                y += 16;
+                int length = snprintf(line, sizeof(line), "%-16s last %8.2f ms  avg %8.2f ms", s.name.c_str(), s.lastMs, s.average_ms());
+                if (s.lastAllocated > 0) length += snprintf(line + length, sizeof(line) - length, "  +%.1f MB (peak %.1f MB)", s.lastAllocated * mb, s.lastPeak * mb);
+                if (profiler::instance().counting() && s.lastCounts.any())
+                {
+                    const counter_sample & c = s.lastCounts;
+                    snprintf(line + length, sizeof(line) - length, "  IPC %.2f  L1D %.2fM  LLC %.2fM  dTLB %.2fM", c.ipc(),
+                        millions(c.values[counter_sample::l1d_misses]), millions(c.values[counter_sample::llc_misses]), millions(c.values[counter_sample::dtlb_misses]));
+                }
+                draw_text(10, y, line);
+            }
+        }
+
         glPopMatrix();
 
+        drawMs = std::chrono::duration<float, std::milli>(frame_clock::now() - lastFrame).count();
         win->swap_buffers();
     }
+
+    if (!tracePath.empty())
+    {
+        if (profiler::instance().write_trace(tracePath)) std::cout << "Wrote trace to " << tracePath << std::endl;
+        else std::cout << "Couldn't write trace to " << tracePath << std::endl;
+    }
+
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,121 @@
+#ifndef memory_hpp
+#define memory_hpp
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+#include "profile.hpp"
+
+///////////////////////////
+//   Memory Accounting   //
+///////////////////////////
+
+// Pipeline buffers (file bytes, decoded pixels, FFT inputs and spectra, pyramids, uploads) report
+// their size to the profiler for as long as they live, charged to the stage running on the thread
+// that allocates them. The HUD shows live and peak bytes per file and per stage.
+
+inline void track_allocation(const int64_t bytes)
+{
+    if (bytes) profiler::instance().allocated(detail::current_stage(), bytes);
+}
+
+inline void track_free(const int64_t bytes)
+{
+    if (bytes) profiler::instance().freed(bytes);
+}
+
+// Accounts for a buffer allocated elsewhere (stb, gli, the GL driver) over this object's lifetime
+class tracked_allocation
+{
+    int64_t bytes = 0;
+public:
+    tracked_allocation() = default;
+    explicit tracked_allocation(const size_t bytes) : bytes(int64_t(bytes)) { track_allocation(this->bytes); }
+    ~tracked_allocation() { track_free(bytes); }
+
+    tracked_allocation(tracked_allocation && r) : bytes(r.bytes) { r.bytes = 0; }
+    tracked_allocation & operator = (tracked_allocation && r)
+    {
+        if (this != &r)
+        {
+            track_free(bytes);
+            bytes = r.bytes;
+            r.bytes = 0;
+        }
+        return *this;
+    }
+
+    tracked_allocation(const tracked_allocation &) = delete;
+    tracked_allocation & operator = (const tracked_allocation &) = delete;
+
+    size_t size() const { return size_t(bytes); }
+};
+
+template <typename T>
+struct tracking_allocator
+{
+    typedef T value_type;
+
+    tracking_allocator() = default;
+    template <typename U> tracking_allocator(const tracking_allocator<U> &) { }
+
+    T * allocate(const size_t n)
+    {
+        T * p = static_cast<T *>(::operator new(n * sizeof(T)));
+        track_allocation(int64_t(n * sizeof(T)));
+        return p;
+    }
+
+    void deallocate(T * p, const size_t n)
+    {
+        track_free(int64_t(n * sizeof(T)));
+        ::operator delete(p);
+    }
+
+    template <typename U> bool operator == (const tracking_allocator<U> &) const { return true; }
+    template <typename U> bool operator != (const tracking_allocator<U> &) const { return false; }
+};
+
+template <typename T> using tracked_vector = std::vector<T, tracking_allocator<T>>;
+
+// Charges allocations made in its scope to a named stage without timing it
+class memory_stage
+{
+    const char * parentStage;
+public:
+    explicit memory_stage(const char * name) : parentStage(detail::current_stage()) { detail::current_stage() = name; }
+    ~memory_stage() { detail::current_stage() = parentStage; }
+
+    memory_stage(const memory_stage &) = delete;
+    memory_stage & operator = (const memory_stage &) = delete;
+};
+
+// Keeps data's allocation counted until the last copy of the returned pointer goes away
+inline std::shared_ptr<const void> track_shared(const std::shared_ptr<const void> & data, const size_t bytes)
+{
+    auto owner = std::make_shared<std::pair<std::shared_ptr<const void>, tracked_allocation>>(data, tracked_allocation(bytes));
+    return std::shared_ptr<const void>(owner, data.get());
+}
+
+///////////////////////
+//   Memory Budget   //
+///////////////////////
+
+// 0 is unlimited. When an allocation would push the live total past the budget, the pipeline picks a
+// leaner strategy where it has one (see compute_layered_pyramid_spectra).
+inline std::atomic<int64_t> & memory_budget()
+{
+    static std::atomic<int64_t> budget { 0 };
+    return budget;
+}
+
+inline bool fits_memory_budget(const int64_t extraBytes)
+{
+    const int64_t budget = memory_budget();
+    return budget <= 0 || profiler::instance().live_bytes() + extraBytes <= budget;
+}
+
+#endif // end memory_hpp
@@ -0,0 +1,184 @@
+#ifndef parallel_hpp
+#define parallel_hpp
+
+#include <thread>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <functional>
+#include <exception>
+#include <algorithm>
+#include "profile.hpp"
+
+///////////////////////////
+//   Parallel Dispatch   //
+///////////////////////////
+
+inline int worker_count()
+{
+    static const int count = std::max(1, (int) std::thread::hardware_concurrency());
+    return count;
+}
+
+// Number of bands parallel_for will split [0, count) into when each band holds at least minBand items
+inline int band_count(const int count, const int minBand = 1)
+{
+    if (count <= 0) return 0;
+    return std::max(1, std::min(worker_count(), count / std::max(1, minBand)));
+}
+
+// Splits [begin, end) into contiguous bands and calls f(bandBegin, bandEnd, bandIndex) once per band.
+// The calling thread runs the first band itself, so small ranges never pay for a thread launch.
+// While tracing, each band is logged under the enclosing stage on its own trace lane. An exception
+// from any band is rethrown on the caller once every band has finished (the first one, if several).
+template <typename F>
+void parallel_for(const int begin, const int end, F f, const int minBand = 1)
+{
+    const int count = end - begin;
+    const int bands = band_count(count, minBand);
+    if (bands == 0) return;
+    if (bands == 1)
+    {
+        f(begin, end, 0);
+        return;
+    }
+
+    auto band_begin = [&](int b) { return begin + int((long long) count * b / bands); };
+
+    const char * stage = detail::current_stage();
+
+    std::mutex failureMutex;
+    std::exception_ptr failure;
+    auto run_band = [&](const int lo, const int hi, const int b)
+    {
+        try
+        {
+            f(lo, hi, b);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(failureMutex);
+            if (!failure) failure = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(bands - 1);
+    for (int b = 1; b < bands; ++b)
+    {
+        workers.emplace_back([&run_band, stage, b, lo = band_begin(b), hi = band_begin(b + 1)]()
+        {
+            scoped_band trace(stage, true);
+            run_band(lo, hi, b);
+        });
+    }
+
+    {
+        scoped_band trace(stage, false);
+        run_band(band_begin(0), band_begin(1), 0);
+    }
+
+    for (auto & w : workers) w.join();
+    if (failure) std::rethrow_exception(failure);
+}
+
+////////////////////////
+//   Background Jobs   //
+////////////////////////
+
+// Runs work(job) on its own thread. The work publishes successively better results (coarse previews
+// first, the exact one last); the owning thread takes the newest whenever it looks, and intermediate
+// ones it never saw are dropped. on_update is called from the job thread after every publish and
+// when the work ends, e.g. to wake an idle event loop. Destruction cancels and waits: work should
+// check cancelled() between steps, or call throw_if_cancelled() inside long ones to unwind at once.
+struct job_cancelled : std::exception
+{
+    const char * what() const noexcept override { return "cancelled"; }
+};
+
+template <typename T>
+class progressive_job
+{
+    std::mutex mutex;
+    std::unique_ptr<T> latest;
+    std::string failure;
+    std::atomic<bool> cancelRequested { false };
+    std::atomic<bool> finished { false };
+    std::function<void()> on_update;
+    std::thread thread;
+
+public:
+
+    template <typename F>
+    progressive_job(F work, std::function<void()> on_update) : on_update(on_update)
+    {
+        thread = std::thread([this, work]()
+        {
+            // A lane of its own, so its stages don't overlap the main thread's in the trace
+            detail::current_lane() = profiler::instance().acquire_lane();
+            try
+            {
+                work(*this);
+            }
+            catch (const job_cancelled &)
+            {
+            }
+            catch (const std::exception & e)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                failure = e.what();
+            }
+            profiler::instance().release_lane(detail::current_lane());
+            finished = true;
+            if (this->on_update) this->on_update();
+        });
+    }
+
+    ~progressive_job()
+    {
+        cancelRequested = true;
+        thread.join();
+    }
+
+    progressive_job(const progressive_job &) = delete;
+    progressive_job & operator = (const progressive_job &) = delete;
+
+    // Job thread
+    void publish(std::unique_ptr<T> result)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            latest = std::move(result);
+        }
+        if (on_update) on_update();
+    }
+
+    bool cancelled() const { return cancelRequested; }
+
+    // Job thread, also from parallel_for bands of the work
+    void throw_if_cancelled() const
+    {
+        if (cancelRequested) throw job_cancelled();
+    }
+
+    // Owning thread: the newest result not taken yet, or null
+    std::unique_ptr<T> take()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return std::move(latest);
+    }
+
+    // True once the work has returned or thrown; take() then holds its last result
+    bool done() const { return finished; }
+
+    // Empty unless the work threw
+    std::string error()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return failure;
+    }
+};
+
+#endif // end parallel_hpp
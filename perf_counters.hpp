@@ -0,0 +1,166 @@
+#ifndef perf_counters_hpp
+#define perf_counters_hpp
+
+#include <stdint.h>
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+///////////////////////////////////
+//   Hardware Counters (Linux)   //
+///////////////////////////////////
+
+// Cycles and instructions tell compute-bound from stalled; the cache and TLB misses say where the
+// stalls come from (the Y pass walks columns, the X pass rows). Counters are opened per thread with
+// inheritance, so a stage's counts include the worker threads it starts. Other platforms, and Linux
+// without permission (perf_event_paranoid, containers), report every counter as unavailable.
+
+struct counter_sample
+{
+    enum { cycles, instructions, l1d_misses, llc_misses, dtlb_misses, count };
+
+    // -1 where the counter couldn't be opened or read
+    int64_t values[count];
+
+    counter_sample() { for (auto & v : values) v = -1; }
+
+    bool any() const
+    {
+        for (auto v : values) if (v >= 0) return true;
+        return false;
+    }
+
+    double ipc() const
+    {
+        return values[cycles] > 0 && values[instructions] >= 0 ? double(values[instructions]) / double(values[cycles]) : 0.0;
+    }
+
+    static const char * name(const int i)
+    {
+        static const char * names[count] = { "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses" };
+        return names[i];
+    }
+};
+
+inline counter_sample operator - (const counter_sample & a, const counter_sample & b)
+{
+    counter_sample r;
+    for (int i = 0; i < counter_sample::count; ++i) r.values[i] = a.values[i] >= 0 && b.values[i] >= 0 ? a.values[i] - b.values[i] : -1;
+    return r;
+}
+
+// Unavailable counters stay unavailable; the first available sample starts the sum
+inline counter_sample & operator += (counter_sample & a, const counter_sample & b)
+{
+    for (int i = 0; i < counter_sample::count; ++i)
+    {
+        if (b.values[i] >= 0) a.values[i] = (a.values[i] >= 0 ? a.values[i] : 0) + b.values[i];
+    }
+    return a;
+}
+
+// The counters of the calling thread and every thread it starts while they are open
+class thread_counters
+{
+    int fds[counter_sample::count];
+    int openError = 0;
+
+#if defined(__linux__)
+    static int open_counter(const uint32_t type, const uint64_t config)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    static uint64_t cache_event(const uint64_t cache, const uint64_t result)
+    {
+        return cache | (uint64_t(PERF_COUNT_HW_CACHE_OP_READ) << 8) | (result << 16);
+    }
+#endif
+
+public:
+
+    thread_counters()
+    {
+        for (auto & fd : fds) fd = -1;
+#if defined(__linux__)
+        fds[counter_sample::cycles] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        fds[counter_sample::instructions] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        fds[counter_sample::l1d_misses] = open_counter(PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS));
+        fds[counter_sample::llc_misses] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        fds[counter_sample::dtlb_misses] = open_counter(PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_RESULT_MISS));
+        if (!any_open()) openError = errno;
+#endif
+    }
+
+    ~thread_counters()
+    {
+#if defined(__linux__)
+        for (auto fd : fds) if (fd >= 0) close(fd);
+#endif
+    }
+
+    thread_counters(const thread_counters &) = delete;
+    thread_counters & operator = (const thread_counters &) = delete;
+
+    bool any_open() const
+    {
+        for (auto fd : fds) if (fd >= 0) return true;
+        return false;
+    }
+
+    // errno of the failed opens when none succeeded
+    int open_error() const { return openError; }
+
+    // Running totals, scaled up when the kernel had to multiplex more counters than the PMU holds
+    counter_sample read() const
+    {
+        counter_sample s;
+#if defined(__linux__)
+        for (int i = 0; i < counter_sample::count; ++i)
+        {
+            uint64_t v[3]; // value, time enabled, time running
+            if (fds[i] < 0 || ::read(fds[i], v, sizeof(v)) != (ssize_t) sizeof(v)) continue;
+            s.values[i] = v[2] > 0 && v[2] < v[1] ? int64_t(double(v[0]) * double(v[1]) / double(v[2])) : int64_t(v[0]);
+        }
+#endif
+        return s;
+    }
+
+    static thread_counters & current()
+    {
+        static thread_local thread_counters counters;
+        return counters;
+    }
+};
+
+// Opens the calling thread's counters; on failure says why
+inline bool hardware_counters_available(std::string & reason)
+{
+#if defined(__linux__)
+    const thread_counters & counters = thread_counters::current();
+    if (counters.any_open()) return true;
+    const int error = counters.open_error();
+    reason = error == EACCES || error == EPERM ? "perf_event_open not permitted (see /proc/sys/kernel/perf_event_paranoid)" : std::string("perf_event_open failed: ") + std::strerror(error);
+    return false;
+#else
+    reason = "hardware counters are only read on Linux";
+    return false;
+#endif
+}
+
+#endif // end perf_counters_hpp
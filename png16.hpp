@@ -0,0 +1,152 @@
+#ifndef png16_hpp
+#define png16_hpp
+
+#include <stdint.h>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <limits>
+#include "third-party/stb/stb_image.h"
+
+////////////////////
+//   16-bit PNG   //
+////////////////////
+
+// stb_image (v2.08) reduces 16-bit PNGs to 8 bits on load. This keeps the full precision: the chunks
+// are walked here, stb's inflate decompresses the image data, and the scanline filters are undone
+// in place. Grey, grey+alpha, RGB and RGBA without interlacing; everything else stays on stb.
+
+namespace detail
+{
+    inline uint32_t read_be32(const uint8_t * p)
+    {
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+
+    // Width and height as stored; the PNG spec caps them at 2^31 - 1 but files may hold anything
+    struct png_header
+    {
+        uint32_t width = 0, height = 0;
+        int bitDepth = 0, colorType = 0, interlace = 0;
+    };
+
+    inline bool read_png_header(const std::vector<uint8_t> & file, png_header & h)
+    {
+        static const uint8_t signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+        if (file.size() < 33 || std::memcmp(file.data(), signature, 8) != 0 || std::memcmp(file.data() + 12, "IHDR", 4) != 0) return false;
+
+        const uint8_t * ihdr = file.data() + 16;
+        h.width = read_be32(ihdr);
+        h.height = read_be32(ihdr + 4);
+        h.bitDepth = ihdr[8];
+        h.colorType = ihdr[9];
+        h.interlace = ihdr[12];
+        return true;
+    }
+
+    // Components per pixel of the color types handled here, 0 for the rest (palette)
+    inline int png_components(const int colorType)
+    {
+        switch (colorType)
+        {
+        case 0: return 1;
+        case 2: return 3;
+        case 4: return 2;
+        case 6: return 4;
+        default: return 0;
+        }
+    }
+
+    inline int paeth(const int a, const int b, const int c)
+    {
+        const int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc) return a;
+        return pb <= pc ? b : c;
+    }
+
+    // Undoes the per-scanline filters of rows of rowBytes bytes, each preceded by its filter type
+    inline void unfilter_png(const uint8_t * filtered, uint8_t * out, const int rows, const size_t rowBytes, const int bytesPerPixel)
+    {
+        for (int y = 0; y < rows; ++y)
+        {
+            const uint8_t filter = filtered[y * (rowBytes + 1)];
+            const uint8_t * src = filtered + y * (rowBytes + 1) + 1;
+            uint8_t * dst = out + y * rowBytes;
+            const uint8_t * up = y > 0 ? dst - rowBytes : nullptr;
+
+            for (size_t i = 0; i < rowBytes; ++i)
+            {
+                const int a = i >= size_t(bytesPerPixel) ? dst[i - bytesPerPixel] : 0;
+                const int b = up ? up[i] : 0;
+                const int c = up && i >= size_t(bytesPerPixel) ? up[i - bytesPerPixel] : 0;
+
+                int predictor = 0;
+                switch (filter)
+                {
+                case 0: predictor = 0; break;
+                case 1: predictor = a; break;
+                case 2: predictor = b; break;
+                case 3: predictor = (a + b) / 2; break;
+                case 4: predictor = paeth(a, b, c); break;
+                default: throw std::runtime_error("corrupt png filter type");
+                }
+                dst[i] = uint8_t(src[i] + predictor);
+            }
+        }
+    }
+}
+
+// True for the PNGs decode_png16 reads at full precision
+inline bool is_png16(const std::vector<uint8_t> & file)
+{
+    detail::png_header h;
+    return detail::read_png_header(file, h) && h.bitDepth == 16 && h.interlace == 0 && detail::png_components(h.colorType) != 0;
+}
+
+// Interleaved 16-bit samples in native byte order
+inline std::vector<uint16_t> decode_png16(const std::vector<uint8_t> & file, int & width, int & height, int & components)
+{
+    detail::png_header h;
+    if (!is_png16(file) || !detail::read_png_header(file, h)) throw std::runtime_error("not a non-interlaced 16-bit png");
+
+    static const uint32_t maxDimension = 0x7fffffff;
+    if (h.width == 0 || h.height == 0 || h.width > maxDimension || h.height > maxDimension) throw std::runtime_error("invalid png dimensions");
+
+    width = int(h.width);
+    height = int(h.height);
+    components = detail::png_components(h.colorType);
+
+    // stb's inflate takes and returns int sizes, so the filtered scanlines must fit one
+    const int bytesPerPixel = 2 * components;
+    const size_t rowBytes = size_t(width) * bytesPerPixel;
+    if (rowBytes + 1 > size_t(std::numeric_limits<int>::max()) / size_t(height)) throw std::runtime_error("png too large");
+    const size_t filteredSize = (rowBytes + 1) * height;
+
+    // The image data may be split over any number of IDAT chunks
+    std::vector<uint8_t> compressed;
+    for (size_t p = 8; p + 12 <= file.size();)
+    {
+        const uint32_t length = detail::read_be32(&file[p]);
+        if (p + 12 + length > file.size()) throw std::runtime_error("truncated png chunk");
+        if (std::memcmp(&file[p + 4], "IDAT", 4) == 0) compressed.insert(compressed.end(), &file[p + 8], &file[p + 8] + length);
+        if (std::memcmp(&file[p + 4], "IEND", 4) == 0) break;
+        p += 12 + length;
+    }
+
+    int inflatedSize = 0;
+    const std::unique_ptr<char, void (*)(void *)> inflated(stbi_zlib_decode_malloc_guesssize_headerflag((const char *) compressed.data(), (int) compressed.size(), (int) filteredSize, &inflatedSize, 1), std::free);
+    if (!inflated) throw std::runtime_error("couldn't inflate png data");
+    if (size_t(inflatedSize) < filteredSize) throw std::runtime_error("truncated png data");
+
+    std::vector<uint8_t> bytes(rowBytes * height);
+    detail::unfilter_png((const uint8_t *) inflated.get(), bytes.data(), height, rowBytes, bytesPerPixel);
+
+    // PNG samples are big endian
+    std::vector<uint16_t> samples(size_t(width) * height * components);
+    for (size_t i = 0; i < samples.size(); ++i) samples[i] = uint16_t((bytes[2 * i] << 8) | bytes[2 * i + 1]);
+    return samples;
+}
+
+#endif // end png16_hpp
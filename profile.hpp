@@ -0,0 +1,313 @@
+#ifndef profile_hpp
+#define profile_hpp
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include "perf_counters.hpp"
+
+///////////////////
+//   Profiling   //
+///////////////////
+
+// Stage timings for the HUD and, with tracing on, a Chrome trace_event log (chrome://tracing or
+// ui.perfetto.dev). A run is one unit of user-visible work, such as processing a dropped file. Each
+// stage's "last" is its total over the last run it took part in and "avg" its mean over those runs.
+// Totals add up every scope on every thread, so stages that run on several workers at once can
+// exceed the wall time of the run. With counters on, every stage also sums its hardware counts.
+// Tracked buffers (memory.hpp) report their bytes here, charged to the stage that allocates them.
+class profiler
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    struct stage_stats
+    {
+        std::string name;
+        double currentMs = 0.0, lastMs = 0.0, totalMs = 0.0;
+        int runs = 0;
+        bool active = false;
+        counter_sample currentCounts, lastCounts, totalCounts;
+
+        // Bytes allocated during the stage, and the most live at once while it allocated
+        int64_t currentAllocated = 0, lastAllocated = 0;
+        int64_t currentPeak = 0, lastPeak = 0;
+
+        explicit stage_stats(const std::string & name) : name(name) { }
+
+        double average_ms() const { return runs ? totalMs / runs : 0.0; }
+    };
+
+    static profiler & instance()
+    {
+        static profiler p;
+        return p;
+    }
+
+    void enable_trace() { traceEnabled = true; }
+    bool tracing() const { return traceEnabled; }
+
+    // Falls back to timings alone, with the reason, when the counters can't be opened
+    bool enable_counters(std::string & reason)
+    {
+        countersEnabled = hardware_counters_available(reason);
+        return countersEnabled;
+    }
+    bool counting() const { return countersEnabled; }
+
+    void begin_run()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto & s : stages)
+        {
+            s.currentMs = 0.0;
+            s.currentCounts = counter_sample();
+            s.currentAllocated = s.currentPeak = 0;
+            s.active = false;
+        }
+        runBegin = clock::now();
+        runPeakBytes = liveBytes;
+    }
+
+    void end_run()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        bool worked = false;
+        for (auto & s : stages)
+        {
+            if (!s.active) continue;
+            s.lastMs = s.currentMs;
+            s.totalMs += s.currentMs;
+            s.lastCounts = s.currentCounts;
+            s.totalCounts += s.currentCounts;
+            s.lastAllocated = s.currentAllocated;
+            s.lastPeak = s.currentPeak;
+            s.runs++;
+            worked = true;
+        }
+
+        // Runs that did nothing (a key press that changed no view) leave the last one standing
+        if (!worked) return;
+        lastRunMs = std::chrono::duration<double, std::milli>(clock::now() - runBegin).count();
+        lastRunPeakBytes = runPeakBytes;
+    }
+
+    void record(const char * stage, const clock::time_point begin, const clock::time_point end, const int lane, const bool band, const counter_sample & counts = counter_sample())
+    {
+        const double ms = std::chrono::duration<double, std::milli>(end - begin).count();
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (!band)
+        {
+            auto it = find_stage(stage);
+            it->currentMs += ms;
+            it->currentCounts += counts;
+            it->active = true;
+        }
+
+        if (traceEnabled) events.push_back({ stage, microseconds(begin), microseconds(end) - microseconds(begin), lane, band, counts });
+    }
+
+    void allocated(const char * stage, const int64_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        liveBytes += bytes;
+        peakBytes = std::max(peakBytes, liveBytes);
+        runPeakBytes = std::max(runPeakBytes, liveBytes);
+
+        auto it = find_stage(stage);
+        it->currentAllocated += bytes;
+        it->currentPeak = std::max(it->currentPeak, liveBytes);
+        it->active = true;
+    }
+
+    void freed(const int64_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        liveBytes -= bytes;
+    }
+
+    int64_t live_bytes() const { std::lock_guard<std::mutex> lock(mutex); return liveBytes; }
+    int64_t peak_bytes() const { std::lock_guard<std::mutex> lock(mutex); return peakBytes; }
+    int64_t run_peak_bytes() const { std::lock_guard<std::mutex> lock(mutex); return runPeakBytes; }
+    int64_t last_run_peak_bytes() const { std::lock_guard<std::mutex> lock(mutex); return lastRunPeakBytes; }
+
+    std::vector<stage_stats> stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stages;
+    }
+
+    double last_run_ms() const { return lastRunMs; }
+
+    // Trace lanes are small reused ids rather than OS thread ids: parallel_for spawns fresh threads
+    // per call, and a thread takes the lowest free lane for as long as it runs
+    int acquire_lane()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = std::find(lanesInUse.begin(), lanesInUse.end(), false);
+        if (it == lanesInUse.end()) it = lanesInUse.insert(lanesInUse.end(), false);
+        *it = true;
+        return int(it - lanesInUse.begin());
+    }
+
+    void release_lane(const int lane)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        lanesInUse[lane] = false;
+    }
+
+    bool write_trace(const std::string & path) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ofstream out(path);
+        if (!out) return false;
+
+        out << "{\"traceEvents\":[\n";
+        for (size_t lane = 0; lane < lanesInUse.size(); ++lane)
+        {
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << lane << ",\"args\":{\"name\":\"" << (lane ? "worker " + std::to_string(lane) : std::string("main")) << "\"}},\n";
+        }
+        for (const auto & e : events)
+        {
+            out << "{\"name\":\"" << e.name << "\",\"cat\":\"" << (e.band ? "band" : "stage") << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.lane << ",\"ts\":" << e.ts << ",\"dur\":" << e.dur;
+            if (e.counts.any())
+            {
+                const char * separator = "";
+                out << ",\"args\":{";
+                for (int i = 0; i < counter_sample::count; ++i)
+                {
+                    if (e.counts.values[i] < 0) continue;
+                    out << separator << "\"" << counter_sample::name(i) << "\":" << e.counts.values[i];
+                    separator = ",";
+                }
+                out << "}";
+            }
+            out << "},\n";
+        }
+        out << "{\"name\":\"end\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":0,\"ts\":" << microseconds(clock::now()) << "}\n]}\n";
+        return bool(out);
+    }
+
+private:
+    struct trace_event
+    {
+        const char * name;
+        long long ts, dur;
+        int lane;
+        bool band;
+        counter_sample counts;
+    };
+
+    profiler() : start(clock::now()), runBegin(start), lanesInUse(1, true) { }
+
+    // Callers hold the mutex
+    std::vector<stage_stats>::iterator find_stage(const char * stage)
+    {
+        auto it = std::find_if(stages.begin(), stages.end(), [&](const stage_stats & s) { return s.name == stage; });
+        if (it == stages.end()) it = stages.insert(stages.end(), stage_stats(stage));
+        return it;
+    }
+
+    long long microseconds(const clock::time_point t) const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(t - start).count();
+    }
+
+    mutable std::mutex mutex;
+    std::atomic<bool> traceEnabled { false };
+    std::atomic<bool> countersEnabled { false };
+    const clock::time_point start;
+    clock::time_point runBegin;
+    double lastRunMs = 0.0;
+    int64_t liveBytes = 0, peakBytes = 0, runPeakBytes = 0, lastRunPeakBytes = 0;
+    std::vector<stage_stats> stages;
+    std::vector<trace_event> events;
+    std::vector<bool> lanesInUse; // lane 0 is the main thread
+};
+
+namespace detail
+{
+    // Trace lane of this thread and the innermost stage it is running, which names its band events
+    inline int & current_lane() { static thread_local int lane = 0; return lane; }
+    inline const char *& current_stage() { static thread_local const char * stage = "other"; return stage; }
+}
+
+// Times one pipeline stage on the calling thread, and counts it when counters are on. name must be a
+// string literal.
+class scoped_timer
+{
+    const char * name;
+    const char * parentStage;
+    const bool counting;
+    counter_sample beginCounts;
+    const profiler::clock::time_point begin;
+public:
+    scoped_timer(const char * name) : name(name), parentStage(detail::current_stage()), counting(profiler::instance().counting()), begin(profiler::clock::now())
+    {
+        detail::current_stage() = name;
+        if (counting) beginCounts = thread_counters::current().read();
+    }
+
+    ~scoped_timer()
+    {
+        const counter_sample counts = counting ? thread_counters::current().read() - beginCounts : counter_sample();
+        profiler::instance().record(name, begin, profiler::clock::now(), detail::current_lane(), false, counts);
+        detail::current_stage() = parentStage;
+    }
+
+    scoped_timer(const scoped_timer &) = delete;
+    scoped_timer & operator = (const scoped_timer &) = delete;
+};
+
+// Brackets one run, however it returns
+struct scoped_run
+{
+    scoped_run() { profiler::instance().begin_run(); }
+    ~scoped_run() { profiler::instance().end_run(); }
+
+    scoped_run(const scoped_run &) = delete;
+    scoped_run & operator = (const scoped_run &) = delete;
+};
+
+// One parallel_for band on its own trace lane; only recorded while tracing
+class scoped_band
+{
+    const char * stage;
+    const bool active;
+    const bool ownsLane;
+    int previousLane = 0;
+    profiler::clock::time_point begin;
+public:
+    scoped_band(const char * stage, const bool workerThread) : stage(stage), active(profiler::instance().tracing()), ownsLane(active && workerThread)
+    {
+        if (!active) return;
+        detail::current_stage() = stage;
+        if (ownsLane)
+        {
+            previousLane = detail::current_lane();
+            detail::current_lane() = profiler::instance().acquire_lane();
+        }
+        begin = profiler::clock::now();
+    }
+
+    ~scoped_band()
+    {
+        if (!active) return;
+        profiler::instance().record(stage, begin, profiler::clock::now(), detail::current_lane(), true);
+        if (ownsLane)
+        {
+            profiler::instance().release_lane(detail::current_lane());
+            detail::current_lane() = previousLane;
+        }
+    }
+
+    scoped_band(const scoped_band &) = delete;
+    scoped_band & operator = (const scoped_band &) = delete;
+};
+
+#endif // end profile_hpp
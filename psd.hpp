@@ -0,0 +1,296 @@
+#ifndef psd_hpp
+#define psd_hpp
+
+#include <stdint.h>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <fstream>
+#include <algorithm>
+#include "image.hpp"
+#include "parallel.hpp"
+#include "memory.hpp"
+
+////////////////////////////////
+//   Power Spectrum Profile   //
+////////////////////////////////
+
+// Radius and angle bin of every frequency of one spectrum size, for spectra in FFT order (not
+// centered). Radii are measured in bins of the larger side, so non-square sizes stay isotropic in
+// cycles per pixel: radial bin k is k / max(w, h) cycles/px. Angles are folded to [0, 180), since a
+// real image's spectrum is point symmetric, in angle_bins bins centered on multiples of their width;
+// 0 degrees is horizontal frequency (vertical structures). Only frequencies inside the Nyquist circle
+// count toward angles, so the corners don't favour the diagonals.
+//
+// Both tables cover one quadrant: |fx| and |fy| give the radius, and the angle of the other quadrants
+// is the mirror (180 - angle) of it. Tables are built once per size and shared, like FFT plans.
+class psd_bin_table
+{
+    int2 size;
+    int quadrantWidth, radialBins;
+    tracked_vector<uint16_t> radius;
+    tracked_vector<uint8_t> angle;
+    std::vector<double> radialCounts, angularCounts;
+    uint8_t identity[256], mirror[256];
+
+public:
+
+    static const int angle_bins = 36;
+
+    // Angle bin of the DC and of frequencies outside the Nyquist circle, dropped from the profile
+    static const int excluded_angle = angle_bins;
+
+    explicit psd_bin_table(const int2 size) : size(size), quadrantWidth(size.x / 2 + 1)
+    {
+        memory_stage stage("psd tables");
+
+        const int n = std::max(size.x, size.y);
+        const int quadrantHeight = size.y / 2 + 1;
+        radialBins = int(std::ceil(0.5 * n * std::sqrt(2.0))) + 1;
+        radius.resize(size_t(quadrantWidth) * quadrantHeight);
+        angle.resize(radius.size());
+
+        for (int i = 0; i < 256; ++i)
+        {
+            identity[i] = uint8_t(i);
+            mirror[i] = uint8_t(i < angle_bins ? (angle_bins - i) % angle_bins : i);
+        }
+
+        const double binDegrees = 180.0 / angle_bins;
+        for (int ay = 0; ay < quadrantHeight; ++ay)
+        {
+            for (int ax = 0; ax < quadrantWidth; ++ax)
+            {
+                const double kx = double(ax) * n / size.x, ky = double(ay) * n / size.y;
+                const double r = std::sqrt(kx * kx + ky * ky);
+                const size_t i = size_t(ay) * quadrantWidth + ax;
+                radius[i] = uint16_t(std::min(radialBins - 1, int(r + 0.5)));
+                if ((ax == 0 && ay == 0) || r > 0.5 * n) angle[i] = excluded_angle;
+                else angle[i] = uint8_t(int(std::floor(std::atan2(ky, kx) * (180.0 / 3.14159265358979323846) / binDegrees + 0.5)) % angle_bins);
+            }
+        }
+
+        // How many frequencies of the whole spectrum land in each bin. A quadrant cell stands for up to
+        // four frequencies, (+-fx, +-fy); on the axes and at Nyquist they coincide.
+        radialCounts.assign(radialBins, 0.0);
+        angularCounts.assign(angle_bins + 1, 0.0);
+        for (int ay = 0; ay < quadrantHeight; ++ay)
+        {
+            const int rows = (ay > 0 && 2 * ay != size.y) ? 2 : 1;
+            for (int ax = 0; ax < quadrantWidth; ++ax)
+            {
+                const int columns = (ax > 0 && 2 * ax != size.x) ? 2 : 1;
+                const size_t i = size_t(ay) * quadrantWidth + ax;
+                radialCounts[radius[i]] += rows * columns;
+                for (int lower = 0; lower < rows; ++lower)
+                    for (int right = 0; right < columns; ++right)
+                        angularCounts[(lower != right ? mirror : identity)[angle[i]]] += 1.0;
+            }
+        }
+    }
+
+    static std::shared_ptr<const psd_bin_table> for_size(const int2 size)
+    {
+        static std::mutex mutex;
+        static std::map<std::pair<int, int>, std::shared_ptr<const psd_bin_table>> tables;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto & t = tables[std::make_pair(size.x, size.y)];
+        if (!t) t = std::make_shared<const psd_bin_table>(size);
+        return t;
+    }
+
+    const int2 & extent() const { return size; }
+    int radial_bins() const { return radialBins; }
+    const uint16_t * radius_row(const int ay) const { return radius.data() + size_t(ay) * quadrantWidth; }
+    const uint8_t * angle_row(const int ay) const { return angle.data() + size_t(ay) * quadrantWidth; }
+
+    // Maps a quadrant angle bin to the bin of a frequency in a mirrored quadrant, or to itself
+    const uint8_t * angle_map(const bool mirrored) const { return mirrored ? mirror : identity; }
+
+    double radial_count(const int bin) const { return radialCounts[bin]; }
+    double angular_count(const int bin) const { return angularCounts[bin]; }
+};
+
+// Mean power |F|^2 per radial and per angular bin of one spectrum
+struct power_spectrum_profile
+{
+    int2 size;
+    std::vector<double> radial, angular;
+
+    double radial_frequency(const int bin) const { return double(bin) / std::max(size.x, size.y); }
+    static double angle_degrees(const int bin) { return bin * 180.0 / psd_bin_table::angle_bins; }
+
+    // Last radial bin inside the Nyquist circle
+    int nyquist_bin() const { return std::max(size.x, size.y) / 2; }
+};
+
+// One pass over magnitudes, a spectrum in FFT order such as compute_magnitudes makes. Rows are split
+// across workers, each adding into its own bins; squaring runs over whole rows so it vectorizes, and
+// the table lookups are the only per-frequency work left.
+inline power_spectrum_profile compute_power_spectrum_profile(const image_view<const float, 1> & magnitudes)
+{
+    const std::shared_ptr<const psd_bin_table> table = psd_bin_table::for_size(magnitudes.size);
+
+    scoped_timer timer("psd");
+
+    const int w = magnitudes.size.x, h = magnitudes.size.y;
+    const int radialBins = table->radial_bins();
+    const int minBand = std::max(1, (1 << 16) / std::max(1, w));
+    std::vector<std::vector<double>> radialBands(std::max(1, band_count(h, minBand)));
+    std::vector<std::vector<double>> angularBands(radialBands.size());
+
+    parallel_for(0, h, [&](int y0, int y1, int band)
+    {
+        // Neighbouring frequencies mostly share a bin, so even and odd columns add into separate copies
+        // and consecutive adds don't wait on each other
+        std::vector<double> radial(2 * size_t(radialBins), 0.0), angular(2 * (psd_bin_table::angle_bins + 1), 0.0);
+        double * radialEven = radial.data(), * radialOdd = radialEven + radialBins;
+        double * angularEven = angular.data(), * angularOdd = angularEven + psd_bin_table::angle_bins + 1;
+        std::vector<float> power(w);
+        for (int y = y0; y < y1; ++y)
+        {
+            for (int x = 0; x < w; ++x)
+            {
+                const float m = magnitudes(y, x);
+                power[x] = m * m;
+            }
+
+            // Rows past h / 2 are negative fy, columns past w / 2 negative fx
+            const bool lower = y > h / 2;
+            const int ay = lower ? h - y : y;
+            const uint16_t * r = table->radius_row(ay);
+            const uint8_t * a = table->angle_row(ay);
+            const uint8_t * leftMap = table->angle_map(lower);
+            const uint8_t * rightMap = table->angle_map(!lower);
+
+            int x = 0;
+            for (; x + 1 <= w / 2; x += 2)
+            {
+                radialEven[r[x]] += power[x];
+                angularEven[leftMap[a[x]]] += power[x];
+                radialOdd[r[x + 1]] += power[x + 1];
+                angularOdd[leftMap[a[x + 1]]] += power[x + 1];
+            }
+            for (; x <= w / 2; ++x)
+            {
+                radialEven[r[x]] += power[x];
+                angularEven[leftMap[a[x]]] += power[x];
+            }
+            for (; x + 1 < w; x += 2)
+            {
+                radialEven[r[w - x]] += power[x];
+                angularEven[rightMap[a[w - x]]] += power[x];
+                radialOdd[r[w - x - 1]] += power[x + 1];
+                angularOdd[rightMap[a[w - x - 1]]] += power[x + 1];
+            }
+            for (; x < w; ++x)
+            {
+                radialEven[r[w - x]] += power[x];
+                angularEven[rightMap[a[w - x]]] += power[x];
+            }
+        }
+
+        for (int i = 0; i < radialBins; ++i) radialEven[i] += radialOdd[i];
+        for (int i = 0; i <= psd_bin_table::angle_bins; ++i) angularEven[i] += angularOdd[i];
+        radial.resize(radialBins);
+        angular.resize(psd_bin_table::angle_bins + 1);
+        radialBands[band] = std::move(radial);
+        angularBands[band] = std::move(angular);
+    }, minBand);
+
+    power_spectrum_profile p;
+    p.size = magnitudes.size;
+    p.radial.assign(radialBins, 0.0);
+    p.angular.assign(psd_bin_table::angle_bins, 0.0);
+    for (size_t b = 0; b < radialBands.size(); ++b)
+    {
+        if (radialBands[b].empty()) continue;
+        for (int i = 0; i < radialBins; ++i) p.radial[i] += radialBands[b][i];
+        for (int i = 0; i < psd_bin_table::angle_bins; ++i) p.angular[i] += angularBands[b][i];
+    }
+    for (int i = 0; i < radialBins; ++i) p.radial[i] = table->radial_count(i) > 0 ? p.radial[i] / table->radial_count(i) : 0.0;
+    for (int i = 0; i < psd_bin_table::angle_bins; ++i) p.angular[i] = table->angular_count(i) > 0 ? p.angular[i] / table->angular_count(i) : 0.0;
+    return p;
+}
+
+// A profile with the file and image it came from, for batch output
+struct named_power_spectrum_profile
+{
+    std::string name;
+    int image;
+    power_spectrum_profile profile;
+};
+
+namespace detail
+{
+    inline std::string json_escape(const std::string & s)
+    {
+        std::string out;
+        for (const char c : s)
+        {
+            if (c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        return out;
+    }
+}
+
+// A path ending in .json gets one object per profile; anything else is CSV with one row per bin:
+// name,image,width,height,profile,bin,value,power where value is cycles/px (radial) or degrees
+// (angular). Radial bins stop at Nyquist.
+inline bool save_power_spectrum_profiles(const std::string & path, const std::vector<named_power_spectrum_profile> & profiles)
+{
+    std::ofstream out(path);
+    if (!out) return false;
+
+    const bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    char line[256];
+    if (json)
+    {
+        out << "{\"profiles\":[\n";
+        for (size_t i = 0; i < profiles.size(); ++i)
+        {
+            const power_spectrum_profile & p = profiles[i].profile;
+            out << "{\"name\":\"" << detail::json_escape(profiles[i].name) << "\",\"image\":" << profiles[i].image << ",\"width\":" << p.size.x << ",\"height\":" << p.size.y;
+            out << ",\"radial\":[";
+            for (int b = 0; b <= p.nyquist_bin(); ++b)
+            {
+                snprintf(line, sizeof(line), "%s[%.6g,%.6g]", b ? "," : "", p.radial_frequency(b), p.radial[b]);
+                out << line;
+            }
+            out << "],\"angular\":[";
+            for (int b = 0; b < (int) p.angular.size(); ++b)
+            {
+                snprintf(line, sizeof(line), "%s[%.6g,%.6g]", b ? "," : "", power_spectrum_profile::angle_degrees(b), p.angular[b]);
+                out << line;
+            }
+            out << "]}" << (i + 1 < profiles.size() ? ",\n" : "\n");
+        }
+        out << "]}\n";
+    }
+    else
+    {
+        out << "name,image,width,height,profile,bin,value,power\n";
+        for (const auto & np : profiles)
+        {
+            const power_spectrum_profile & p = np.profile;
+            for (int b = 0; b <= p.nyquist_bin(); ++b)
+            {
+                snprintf(line, sizeof(line), ",%d,%d,%d,radial,%d,%.6g,%.6g\n", np.image, p.size.x, p.size.y, b, p.radial_frequency(b), p.radial[b]);
+                out << np.name << line;
+            }
+            for (int b = 0; b < (int) p.angular.size(); ++b)
+            {
+                snprintf(line, sizeof(line), ",%d,%d,%d,angular,%d,%.6g,%.6g\n", np.image, p.size.x, p.size.y, b, power_spectrum_profile::angle_degrees(b), p.angular[b]);
+                out << np.name << line;
+            }
+        }
+    }
+    return bool(out);
+}
+
+#endif // end psd_hpp
@@ -0,0 +1,260 @@
+#ifndef reduce_hpp
+#define reduce_hpp
+
+#include <stdint.h>
+#include <cstring>
+#include <cmath>
+#include <complex>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include "parallel.hpp"
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#endif
+
+///////////////////////
+//   Log Histogram   //
+///////////////////////
+
+// Histogram of non-negative floats with bins spaced logarithmically: the bin is the exponent plus
+// the top mantissa bits of the value. It needs no range up front, so it fills in the same sweep
+// that discovers min/max. Each octave is split into 2^sub_bits bins (~9% wide for sub_bits = 3).
+struct log_histogram
+{
+    static const int sub_bits = 3;
+    static const int bins = 256 << sub_bits;
+
+    std::vector<uint32_t> counts;
+
+    log_histogram() : counts(bins, 0) { }
+
+    static int bin_of(const float v)
+    {
+        uint32_t x;
+        std::memcpy(&x, &v, sizeof(x));
+        return int((x & 0x7fffffff) >> (23 - sub_bits));
+    }
+
+    // Smallest value that lands in bin b
+    static float bin_lower(const int b)
+    {
+        const uint32_t x = uint32_t(b) << (23 - sub_bits);
+        float v;
+        std::memcpy(&v, &x, sizeof(v));
+        return v;
+    }
+
+    void merge(const log_histogram & r)
+    {
+        for (int b = 0; b < bins; ++b) counts[b] += r.counts[b];
+    }
+
+    // Value below which a fraction p of the counted values lie, interpolated linearly inside the bin
+    // that holds it, so it is within one bin's width of the exact percentile. 0 when empty.
+    float percentile(const double p) const
+    {
+        uint64_t total = 0;
+        for (const uint32_t c : counts) total += c;
+        if (total == 0) return 0.0f;
+
+        const double rank = std::min(std::max(p, 0.0), 1.0) * double(total);
+        uint64_t below = 0;
+        for (int b = 0; b < bins; ++b)
+        {
+            if (counts[b] == 0 || double(below + counts[b]) < rank)
+            {
+                below += counts[b];
+                continue;
+            }
+            if (b + 1 >= bins) return bin_lower(b);
+            const double t = (rank - double(below)) / double(counts[b]);
+            return float(bin_lower(b) + t * (double(bin_lower(b + 1)) - bin_lower(b)));
+        }
+        return bin_lower(bins - 1);
+    }
+};
+
+///////////////////////////
+//   Reduction Kernels   //
+///////////////////////////
+
+// Everything the pipeline needs from one pass over a buffer. For complex input the statistics are of
+// the magnitudes |z|; sum_squares is then the spectral energy used for Parseval checks.
+struct reduction
+{
+    size_t count = 0;
+    double sum = 0.0;
+    double sum_squares = 0.0;
+    float min = std::numeric_limits<float>::max();
+    float max = std::numeric_limits<float>::lowest();
+    log_histogram histogram;
+
+    double mean() const { return count ? sum / count : 0.0; }
+
+    void merge(const reduction & r)
+    {
+        count += r.count;
+        sum += r.sum;
+        sum_squares += r.sum_squares;
+        min = std::min(min, r.min);
+        max = std::max(max, r.max);
+    }
+};
+
+namespace detail
+{
+    // Values are summed in float over short blocks and the block sums carried in double. Block error
+    // stays at float epsilon times a few hundred values, so 67M pixels no longer drift.
+    static const int reduction_block = 1024;
+    static const int reduction_min_band = 1 << 16;
+
+#if defined(__AVX2__)
+    // a * b + c, fused when the compiler may use FMA: MSVC's /arch:AVX2 implies it, GCC and Clang
+    // need -mfma on top of -mavx2
+    inline __m256 multiply_add(const __m256 a, const __m256 b, const __m256 c)
+    {
+#if defined(__FMA__) || defined(_MSC_VER)
+        return _mm256_fmadd_ps(a, b, c);
+#else
+        return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+    }
+
+    inline float horizontal_sum(const __m256 v)
+    {
+        const __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        const __m128 t = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        return _mm_cvtss_f32(_mm_add_ss(t, _mm_shuffle_ps(t, t, 1)));
+    }
+
+    inline float horizontal_min(const __m256 v)
+    {
+        const __m128 s = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        const __m128 t = _mm_min_ps(s, _mm_movehl_ps(s, s));
+        return _mm_cvtss_f32(_mm_min_ss(t, _mm_shuffle_ps(t, t, 1)));
+    }
+
+    inline float horizontal_max(const __m256 v)
+    {
+        const __m128 s = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        const __m128 t = _mm_max_ps(s, _mm_movehl_ps(s, s));
+        return _mm_cvtss_f32(_mm_max_ss(t, _mm_shuffle_ps(t, t, 1)));
+    }
+
+    inline void accumulate_histogram(log_histogram & h, const __m256 v)
+    {
+        alignas(32) int32_t idx[8];
+        const __m256i bits = _mm256_and_si256(_mm256_castps_si256(v), _mm256_set1_epi32(0x7fffffff));
+        _mm256_store_si256((__m256i *) idx, _mm256_srli_epi32(bits, 23 - log_histogram::sub_bits));
+        for (int i = 0; i < 8; ++i) h.counts[idx[i]]++;
+    }
+#endif
+
+    // Reduces one band. load(i) yields the i-th value for the scalar tail; load8(i) yields values
+    // [i, i + 8) as a vector (in any order, which none of the statistics care about).
+    template <typename Scalar, typename Vector>
+    void reduce_band(reduction & r, const size_t begin, const size_t end, const bool withHistogram, Scalar load, Vector load8)
+    {
+        size_t i = begin;
+
+#if defined(__AVX2__)
+        __m256 vmin = _mm256_set1_ps(r.min);
+        __m256 vmax = _mm256_set1_ps(r.max);
+        while (i + 8 <= end)
+        {
+            const size_t blockEnd = std::min(end, i + reduction_block);
+            __m256 vsum = _mm256_setzero_ps();
+            __m256 vsq = _mm256_setzero_ps();
+            for (; i + 8 <= blockEnd; i += 8)
+            {
+                const __m256 v = load8(i);
+                vsum = _mm256_add_ps(vsum, v);
+                vsq = multiply_add(v, v, vsq);
+                vmin = _mm256_min_ps(vmin, v);
+                vmax = _mm256_max_ps(vmax, v);
+                if (withHistogram) accumulate_histogram(r.histogram, v);
+            }
+            r.sum += horizontal_sum(vsum);
+            r.sum_squares += horizontal_sum(vsq);
+        }
+        r.min = horizontal_min(vmin);
+        r.max = horizontal_max(vmax);
+#else
+        (void)load8;
+#endif
+
+        while (i < end)
+        {
+            const size_t blockEnd = std::min(end, i + reduction_block);
+            float sum = 0.0f, sq = 0.0f;
+            for (; i < blockEnd; ++i)
+            {
+                const float v = load(i);
+                sum += v;
+                sq += v * v;
+                r.min = std::min(r.min, v);
+                r.max = std::max(r.max, v);
+                if (withHistogram) r.histogram.counts[log_histogram::bin_of(v)]++;
+            }
+            r.sum += sum;
+            r.sum_squares += sq;
+        }
+    }
+
+    template <typename Scalar, typename Vector>
+    reduction reduce_parallel(const size_t count, const bool withHistogram, Scalar load, Vector load8)
+    {
+        const int n = (int) std::min<size_t>(count, std::numeric_limits<int>::max());
+        std::vector<reduction> partials(std::max(1, band_count(n, reduction_min_band)));
+
+        parallel_for(0, n, [&](int lo, int hi, int band)
+        {
+            partials[band].count = hi - lo;
+            reduce_band(partials[band], lo, hi, withHistogram, load, load8);
+        }, reduction_min_band);
+
+        reduction result;
+        for (auto & p : partials)
+        {
+            if (p.count == 0) continue;
+            result.merge(p);
+            if (withHistogram) result.histogram.merge(p.histogram);
+        }
+        return result;
+    }
+}
+
+inline reduction reduce_values(const float * data, const size_t count, const bool withHistogram = false)
+{
+    return detail::reduce_parallel(count, withHistogram,
+        [data](size_t i) { return data[i]; },
+#if defined(__AVX2__)
+        [data](size_t i) { return _mm256_loadu_ps(data + i); }
+#else
+        nullptr
+#endif
+    );
+}
+
+// Statistics of |z|; histogram bins are of the magnitude
+inline reduction reduce_magnitudes(const std::complex<float> * data, const size_t count, const bool withHistogram = false)
+{
+    return detail::reduce_parallel(count, withHistogram,
+        [data](size_t i) { return std::abs(data[i]); },
+#if defined(__AVX2__)
+        [data](size_t i)
+        {
+            const float * f = reinterpret_cast<const float *>(data);
+            const __m256 a = _mm256_loadu_ps(f + 2 * i);
+            const __m256 b = _mm256_loadu_ps(f + 2 * i + 8);
+            return _mm256_sqrt_ps(_mm256_hadd_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b)));
+        }
+#else
+        nullptr
+#endif
+    );
+}
+
+#endif // end reduce_hpp
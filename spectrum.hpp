@@ -0,0 +1,378 @@
+#ifndef spectrum_hpp
+#define spectrum_hpp
+
+#include <complex>
+#include <vector>
+#include <utility>
+#include <tuple>
+#include <limits>
+#include <algorithm>
+#include "image.hpp"
+#include "reduce.hpp"
+#include "fft.hpp"
+
+//////////////////////////
+//   Display Spectrum   //
+//////////////////////////
+
+// The real parts of an interleaved complex buffer as a luminance view, so loaders and decoders can
+// write the FFT input directly instead of staging a float image first
+inline image_view<float, 1> real_view(std::complex<float> * data, const int2 size)
+{
+    return image_view<float, 1>(reinterpret_cast<float *>(data), size, int2(2, 2 * size.x));
+}
+
+// The imaginary parts, for packing a second real image into the same transform
+inline image_view<float, 1> imag_view(std::complex<float> * data, const int2 size)
+{
+    return image_view<float, 1>(reinterpret_cast<float *>(data) + 1, size, int2(2, 2 * size.x));
+}
+
+// FFT input and output for one image, charged to its own line in the memory accounting
+inline complex_buffer complex_buffer_for(const int2 size)
+{
+    memory_stage stage("fft buffers");
+    return complex_buffer(size_t(size.x) * size.y);
+}
+
+// Mean-removed 2D FFT of whatever fill(image_view<float, 1>) writes into the input's real parts.
+// The zero frequency stays at the origin.
+template <typename Fill>
+complex_buffer compute_complex_spectrum(fft_plan_2d & plan, Fill fill)
+{
+    const int2 size = plan.extent();
+    complex_buffer imgAsComplexArray = complex_buffer_for(size);
+    fill(real_view(imgAsComplexArray.data(), size));
+
+    plan.execute(imgAsComplexArray.data());
+
+    // Subtracting the mean only changes the DC bin, so zero it here instead of in a pass beforehand
+    imgAsComplexArray[0] = 0.0f;
+    return imgAsComplexArray;
+}
+
+template <typename Fill>
+complex_buffer compute_complex_spectrum(const int2 size, Fill fill)
+{
+    fft_plan_2d plan(size);
+    return compute_complex_spectrum(plan, fill);
+}
+
+inline complex_buffer compute_complex_spectrum(const image_view<const float, 1> & img)
+{
+    return compute_complex_spectrum(img.size, [&](const image_view<float, 1> & fftInput) { copy_image<float, 1>(img, fftInput); });
+}
+
+// Mean-removed spectra of two real images of the same size from a single complex FFT: fillA writes
+// the real parts and fillB the imaginary parts of z = a + ib. Both spectra are Hermitian, so with
+// m the mirrored bin (-k) they separate as B[k] = (Z[k] - conj(Z[m])) / 2i and A[k] = Z[k] - iB[k].
+// Half the transform work of two compute_complex_spectrum calls, for A/B pairs and channel pairs.
+template <typename FillA, typename FillB>
+std::pair<complex_buffer, complex_buffer> compute_complex_spectrum_pair(fft_plan_2d & plan, FillA fillA, FillB fillB)
+{
+    const int2 size = plan.extent();
+    complex_buffer z = complex_buffer_for(size);
+    fillA(real_view(z.data(), size));
+    fillB(imag_view(z.data(), size));
+
+    plan.execute(z.data());
+
+    complex_buffer b = complex_buffer_for(size);
+    parallel_for(0, size.y, [&](int y0, int y1, int)
+    {
+        for (int y = y0; y < y1; ++y)
+        {
+            const std::complex<float> * row = &z[size_t(y) * size.x];
+            const std::complex<float> * mirrorRow = &z[size_t((size.y - y) % size.y) * size.x];
+            std::complex<float> * dst = &b[size_t(y) * size.x];
+
+            dst[0] = std::complex<float>(0.0f, -0.5f) * (row[0] - std::conj(mirrorRow[0]));
+            for (int x = 1; x < size.x; ++x)
+            {
+                dst[x] = std::complex<float>(0.0f, -0.5f) * (row[x] - std::conj(mirrorRow[size.x - x]));
+            }
+        }
+    }, fft_min_band(size.x));
+
+    // Only z's own bins are touched now, so A can replace it in place
+    parallel_for(0, size.y, [&](int y0, int y1, int)
+    {
+        for (size_t i = size_t(y0) * size.x; i < size_t(y1) * size.x; ++i)
+        {
+            z[i] -= std::complex<float>(0.0f, 1.0f) * b[i];
+        }
+    }, fft_min_band(size.x));
+
+    z[0] = 0.0f;
+    b[0] = 0.0f;
+    return { std::move(z), std::move(b) };
+}
+
+// Spectra of several real channels of one image, fill(channel, fftInput) producing each. The channels
+// share one plan and go through it two at a time as packed pairs, so four channels cost two transforms.
+template <typename Fill>
+std::vector<complex_buffer> compute_channel_spectra(const int2 size, const int channels, Fill fill)
+{
+    fft_plan_2d plan(size);
+    std::vector<complex_buffer> spectra(channels);
+
+    for (int c = 0; c + 1 < channels; c += 2)
+    {
+        std::tie(spectra[c], spectra[c + 1]) = compute_complex_spectrum_pair(plan,
+            [&](const image_view<float, 1> & fftInput) { fill(c, fftInput); },
+            [&](const image_view<float, 1> & fftInput) { fill(c + 1, fftInput); });
+    }
+
+    if (channels & 1)
+    {
+        spectra.back() = compute_complex_spectrum(plan, [&](const image_view<float, 1> & fftInput) { fill(channels - 1, fftInput); });
+    }
+    return spectra;
+}
+
+// Magnitudes |z| of a complex spectrum. They are mapped for display only when drawn (display.hpp).
+inline void compute_magnitudes(const std::complex<float> * spectrum, const image_view<float, 1> & out)
+{
+    scoped_timer timer("magnitude");
+
+    parallel_for(0, out.size.y, [&](int y0, int y1, int)
+    {
+        for (int y = y0; y < y1; y++)
+        {
+            for (int x = 0; x < out.size.x; x++)
+            {
+                const auto v = spectrum[size_t(y) * out.size.x + x];
+                out(y, x) = std::sqrt((v.real() * v.real()) + (v.imag() * v.imag()));
+            }
+        }
+    }, fft_min_band(out.size.x));
+}
+
+// The same magnitudes from compute_real_fft_2d, for when a complex buffer of the whole image
+// would not fit the memory budget. fill writes the image into a plain float view.
+template <typename Fill>
+void compute_real_magnitude_spectrum(const int2 size, Fill fill, const image_view<float, 1> & out)
+{
+    assert(out.size == size && can_real_fft_2d(size));
+
+    tracked_vector<float> data;
+    complex_buffer nyquist;
+    {
+        memory_stage stage("fft buffers");
+        data.resize(size_t(size.x) * size.y);
+        nyquist.resize(size.y);
+    }
+    fill(image_view<float, 1>(data.data(), size));
+
+    compute_real_fft_2d(data.data(), size, nyquist.data());
+
+    scoped_timer timer("magnitude");
+
+    const int half = size.x / 2;
+    const std::complex<float> * bins = reinterpret_cast<const std::complex<float> *>(data.data());
+
+    // Bins right of Nyquist mirror through the origin; the mean only lives in bin 0
+    auto magnitude = [&](const int y, const int x)
+    {
+        if (y == 0 && x == 0) return 0.0f;
+        if (x < half) return std::abs(bins[size_t(y) * half + x]);
+        if (x == half) return std::abs(nyquist[y]);
+        return std::abs(bins[size_t((size.y - y) % size.y) * half + size.x - x]);
+    };
+
+    parallel_for(0, size.y, [&](int y0, int y1, int)
+    {
+        for (int y = y0; y < y1; ++y)
+            for (int x = 0; x < size.x; ++x)
+                out(y, x) = magnitude(y, x);
+    }, fft_min_band(size.x));
+}
+
+// Magnitudes of whatever fill writes, taking the real in-place transform when a complex buffer of
+// the whole image won't fit the memory budget
+template <typename Fill>
+void compute_budgeted_magnitude_spectrum(const int2 size, Fill fill, const image_view<float, 1> & out)
+{
+    if (can_real_fft_2d(size) && !fits_memory_budget(int64_t(size.x) * size.y * sizeof(std::complex<float>))) compute_real_magnitude_spectrum(size, fill, out);
+    else compute_magnitudes(compute_complex_spectrum(size, fill).data(), out);
+}
+
+// Centering happens when drawn
+inline void compute_magnitude_spectrum(const image_view<const float, 1> & img, const image_view<float, 1> & out)
+{
+    assert(img.size == out.size);
+    compute_magnitudes(compute_complex_spectrum(img).data(), out);
+}
+
+// Spectra of every level of several mip chains (array layers, cube faces), where chain(image) is the
+// pyramid receiving an image's spectra and fill(image, level, fftInput) produces each level's
+// luminance. Levels large enough to saturate the workers through their own row/column bands run one
+// after another; every remaining (image, level) pair across all chains is then spread over the
+// workers, one whole level each.
+// Under a memory budget, levels whose complex buffer won't fit take the real in-place transform, and
+// the small levels run one at a time when a buffer per worker won't fit.
+template <typename Chain, typename Fill>
+void compute_layered_pyramid_spectra(const int images, Chain chain, Fill fill)
+{
+    auto compute_level = [&](const int2 job)
+    {
+        const image_view<float, 1> out = chain(job.x).level(job.y);
+        auto levelFill = [&](const image_view<float, 1> & fftInput) { fill(job.x, job.y, fftInput); };
+
+        compute_budgeted_magnitude_spectrum(out.size, levelFill, out);
+    };
+
+    std::vector<int2> serialJobs;
+    int64_t largestSerialJob = 0;
+    for (int i = 0; i < images; ++i)
+    {
+        for (int l = 0; l < (int) chain(i).levels(); ++l)
+        {
+            const int2 size = chain(i).level(l).size;
+            if (!fft_runs_serial(size))
+            {
+                compute_level({ i, l });
+                continue;
+            }
+            serialJobs.push_back({ i, l });
+            largestSerialJob = std::max(largestSerialJob, int64_t(size.x) * size.y * int64_t(sizeof(std::complex<float>)));
+        }
+    }
+
+    const int minJobs = fits_memory_budget(largestSerialJob * worker_count()) ? 1 : (int) serialJobs.size();
+    parallel_for(0, (int) serialJobs.size(), [&](int j0, int j1, int)
+    {
+        for (int j = j0; j < j1; ++j) compute_level(serialJobs[j]);
+    }, minJobs);
+}
+
+// Spectra of every level of a single mip chain, where fill(level, fftInput) produces each level
+template <typename Fill>
+void compute_pyramid_spectra(image_buffer_pyramid<float, 1> & spectra, Fill fill)
+{
+    compute_layered_pyramid_spectra(1, [&](int) -> image_buffer_pyramid<float, 1> & { return spectra; },
+        [&](int, const int level, const image_view<float, 1> & fftInput) { fill(level, fftInput); });
+}
+
+inline void compute_pyramid_spectra(image_buffer_pyramid<float, 1> & images, image_buffer_pyramid<float, 1> & spectra)
+{
+    assert(images.levels() == spectra.levels());
+
+    compute_pyramid_spectra(spectra, [&](const int l, const image_view<float, 1> & fftInput)
+    {
+        copy_image<float, 1>(images.level(l), fftInput);
+    });
+}
+
+//////////////////////////
+//   Analytic Pyramid   //
+//////////////////////////
+
+namespace detail
+{
+    // Per-axis weights of the 2:1 box reduction in frequency: the half-size bin k gathers bins k and
+    // k + N/2 of the parent, scaled by (1 + w) / 4 and (1 - w) / 4 with w = exp(2 pi i k / N). The
+    // first is the box filter's transfer function, the second folds the band above the new Nyquist
+    // back in, which is exactly the aliasing resize_box introduces. Length-1 axes pass through.
+    struct fold_axis
+    {
+        int half = 0;
+        complex_buffer keep, alias;
+
+        fold_axis(const int inLength, const int outLength) : keep(outLength), alias(outLength)
+        {
+            if (inLength == 1)
+            {
+                keep[0] = 1.0f;
+                return;
+            }
+
+            half = outLength;
+            for (int k = 0; k < outLength; ++k)
+            {
+                const std::complex<double> w = std::polar(1.0, 2.0 * 3.14159265358979323846 * k / inLength);
+                keep[k] = std::complex<float>((1.0 + w) * 0.25);
+                alias[k] = std::complex<float>((1.0 - w) * 0.25);
+            }
+        }
+    };
+}
+
+// The half-size spectrum a 2:1 resize_box would produce, computed from the parent's spectrum alone.
+// Exact for even and length-1 axes (every power-of-two chain), at six complex multiplies per output bin.
+inline complex_buffer fold_spectrum(const complex_buffer & in, const int2 inSize)
+{
+    assert((inSize.x == 1 || (inSize.x & 1) == 0) && (inSize.y == 1 || (inSize.y & 1) == 0));
+
+    scoped_timer timer("fold");
+
+    const int2 outSize = { std::max(1, inSize.x / 2), std::max(1, inSize.y / 2) };
+    const detail::fold_axis fx(inSize.x, outSize.x), fy(inSize.y, outSize.y);
+
+    complex_buffer out(size_t(outSize.x) * outSize.y);
+
+    parallel_for(0, outSize.y, [&](int y0, int y1, int)
+    {
+        for (int l = y0; l < y1; ++l)
+        {
+            const std::complex<float> * r0 = &in[size_t(l) * inSize.x];
+            const std::complex<float> * r1 = &in[size_t(l + fy.half) * inSize.x];
+            std::complex<float> * dst = &out[size_t(l) * outSize.x];
+
+            for (int k = 0; k < outSize.x; ++k)
+            {
+                const std::complex<float> a = fx.keep[k] * r0[k] + fx.alias[k] * r0[k + fx.half];
+                const std::complex<float> b = fx.keep[k] * r1[k] + fx.alias[k] * r1[k + fx.half];
+                dst[k] = fy.keep[l] * a + fy.alias[l] * b;
+            }
+        }
+    }, fft_min_band(outSize.x));
+
+    return out;
+}
+
+inline bool can_fold_spectrum(const int2 size)
+{
+    return is_power_of_two(size.x) && is_power_of_two(size.y);
+}
+
+// Every level's spectrum from a single FFT of the base level, O(N^2) in total. Power-of-two bases only.
+inline void compute_analytic_pyramid_spectra(const image_view<const float, 1> & base, image_buffer_pyramid<float, 1> & spectra)
+{
+    assert(can_fold_spectrum(base.size) && base.size == spectra.level(0).size);
+
+    complex_buffer spectrum = compute_complex_spectrum(base);
+    compute_magnitudes(spectrum.data(), spectra.level(0));
+
+    for (int l = 1; l < (int) spectra.levels(); ++l)
+    {
+        spectrum = fold_spectrum(spectrum, spectra.level(l - 1).size);
+        compute_magnitudes(spectrum.data(), spectra.level(l));
+    }
+}
+
+// Relative RMS error of each folded level against the exact FFT of the box-filtered mip
+inline std::vector<double> analytic_pyramid_error(image_buffer_pyramid<float, 1> & images)
+{
+    std::vector<double> errors(1, 0.0);
+    complex_buffer folded = compute_complex_spectrum(images.level(0));
+
+    for (int l = 1; l < (int) images.levels(); ++l)
+    {
+        folded = fold_spectrum(folded, images.level(l - 1).size);
+        folded[0] = 0.0f;
+
+        const complex_buffer exact = compute_complex_spectrum(images.level(l));
+
+        double diff = 0.0, energy = 0.0;
+        for (size_t i = 0; i < exact.size(); ++i)
+        {
+            diff += std::norm(std::complex<double>(folded[i] - exact[i]));
+            energy += std::norm(std::complex<double>(exact[i]));
+        }
+        errors.push_back(energy > 0.0 ? std::sqrt(diff / energy) : std::sqrt(diff));
+    }
+    return errors;
+}
+
+#endif // end spectrum_hpp
@@ -0,0 +1,317 @@
+#ifndef texture_decode_hpp
+#define texture_decode_hpp
+
+#include <stdexcept>
+#include <cstring>
+#include "util.hpp"
+#include "image.hpp"
+#include "parallel.hpp"
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#endif
+
+//////////////////////////
+//   Texture Decoding   //
+//////////////////////////
+
+namespace detail
+{
+    enum class block_kind { bc1, bc2, bc3, bc4, bc5 };
+
+    inline float rgb565_value(const uint16_t c, const channel_weights & w)
+    {
+        return w(float(c >> 11) / 31.0f, float((c >> 5) & 0x3f) / 63.0f, float(c & 0x1f) / 31.0f, 0.0f);
+    }
+
+    // Channels are linear in RGBA, so the interpolated entries of a BC1-BC3 color palette follow
+    // directly from the two endpoint values. Only BC1 carries alpha in its color block: opaque, or
+    // punch-through black for the last entry of the three-color mode.
+    inline void color_palette(const uint8_t * colorBlock, const bool punchThrough, const channel_weights & w, float palette[4])
+    {
+        uint16_t c0, c1;
+        std::memcpy(&c0, colorBlock, 2);
+        std::memcpy(&c1, colorBlock + 2, 2);
+
+        const float l0 = rgb565_value(c0, w), l1 = rgb565_value(c1, w);
+        palette[0] = l0;
+        palette[1] = l1;
+
+        if (c0 > c1 || !punchThrough)
+        {
+            palette[2] = (2.0f / 3.0f) * l0 + (1.0f / 3.0f) * l1;
+            palette[3] = (1.0f / 3.0f) * l0 + (2.0f / 3.0f) * l1;
+        }
+        else
+        {
+            palette[2] = 0.5f * (l0 + l1);
+            palette[3] = 0.0f;
+        }
+
+        if (punchThrough && w.a != 0.0f)
+        {
+            for (int i = 0; i < 3; ++i) palette[i] += w.a;
+            if (c0 > c1) palette[3] += w.a;
+        }
+    }
+
+    // Eight-entry BC4 (unorm) palette
+    inline void channel_palette(const uint8_t * channelBlock, float palette[8])
+    {
+        const float e0 = channelBlock[0] / 255.0f, e1 = channelBlock[1] / 255.0f;
+        palette[0] = e0;
+        palette[1] = e1;
+
+        if (channelBlock[0] > channelBlock[1])
+        {
+            for (int i = 1; i < 7; ++i) palette[i + 1] = (float(7 - i) * e0 + float(i) * e1) / 7.0f;
+        }
+        else
+        {
+            for (int i = 1; i < 5; ++i) palette[i + 1] = (float(5 - i) * e0 + float(i) * e1) / 5.0f;
+            palette[6] = 0.0f;
+            palette[7] = 1.0f;
+        }
+    }
+
+    // 16 texels in row-major order. The palette lookups run as in-register permutes: the shifted
+    // index bits select palette lanes directly, two block rows per instruction.
+    inline void color_block_values(const uint8_t * colorBlock, const bool punchThrough, const channel_weights & w, float texels[16])
+    {
+        alignas(16) float palette[4];
+        color_palette(colorBlock, punchThrough, w, palette);
+        const uint8_t * rows = colorBlock + 4;
+
+#if defined(__AVX2__)
+        const __m256 p = _mm256_broadcast_ps((const __m128 *) palette);
+        const __m256i shifts = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+        for (int r = 0; r < 4; r += 2)
+        {
+            const __m256i bits = _mm256_setr_epi32(rows[r], rows[r], rows[r], rows[r], rows[r + 1], rows[r + 1], rows[r + 1], rows[r + 1]);
+            _mm256_storeu_ps(texels + 4 * r, _mm256_permutevar_ps(p, _mm256_srlv_epi32(bits, shifts)));
+        }
+#else
+        for (int r = 0; r < 4; ++r)
+            for (int c = 0; c < 4; ++c)
+                texels[4 * r + c] = palette[(rows[r] >> (2 * c)) & 3];
+#endif
+    }
+
+    inline void channel_block_values(const uint8_t * channelBlock, float texels[16])
+    {
+        alignas(32) float palette[8];
+        channel_palette(channelBlock, palette);
+
+        uint64_t bits = 0;
+        std::memcpy(&bits, channelBlock + 2, 6);
+
+#if defined(__AVX2__)
+        const __m256 p = _mm256_load_ps(palette);
+        const __m256i shifts = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+        for (int half = 0; half < 2; ++half)
+        {
+            const __m256i idx = _mm256_srlv_epi32(_mm256_set1_epi32(int((bits >> (24 * half)) & 0xffffff)), shifts);
+            _mm256_storeu_ps(texels + 8 * half, _mm256_permutevar8x32_ps(p, idx));
+        }
+#else
+        for (int i = 0; i < 16; ++i) texels[i] = palette[(bits >> (3 * i)) & 7];
+#endif
+    }
+
+    // BC2's explicit 4-bit alpha
+    inline void explicit_alpha_values(const uint8_t * alphaBlock, float texels[16])
+    {
+        uint64_t bits;
+        std::memcpy(&bits, alphaBlock, 8);
+        for (int i = 0; i < 16; ++i) texels[i] = float((bits >> (4 * i)) & 0xf) / 15.0f;
+    }
+
+    // One channel of a block. Channels a format lacks read as zero and a missing alpha as opaque,
+    // as in gli's decoder.
+    inline void block_values(const block_kind kind, const uint8_t * block, const channel_weights & w, float texels[16])
+    {
+        alignas(32) float extra[16];
+
+        switch (kind)
+        {
+        case block_kind::bc1:
+            color_block_values(block, true, w, texels);
+            break;
+        case block_kind::bc2:
+        case block_kind::bc3:
+            color_block_values(block + 8, false, w, texels);
+            if (w.a != 0.0f)
+            {
+                if (kind == block_kind::bc2) explicit_alpha_values(block, extra);
+                else channel_block_values(block, extra);
+                for (int i = 0; i < 16; ++i) texels[i] += w.a * extra[i];
+            }
+            break;
+        case block_kind::bc4:
+            channel_block_values(block, texels);
+            for (int i = 0; i < 16; ++i) texels[i] = w(texels[i], 0.0f, 0.0f, 1.0f);
+            break;
+        case block_kind::bc5:
+            channel_block_values(block, texels);
+            channel_block_values(block + 8, extra);
+            for (int i = 0; i < 16; ++i) texels[i] = w(texels[i], extra[i], 0.0f, 1.0f);
+            break;
+        }
+    }
+
+    // Writes one block row of four texels. A pixel stride of 2 is the real or imaginary part of an
+    // interleaved complex buffer; the masked store leaves the other part untouched.
+    inline void store_block_row(float * dst, const int strideX, const float * texels, const int count)
+    {
+#if defined(__AVX2__)
+        if (count == 4 && strideX == 1)
+        {
+            _mm_storeu_ps(dst, _mm_loadu_ps(texels));
+            return;
+        }
+        if (count == 4 && strideX == 2)
+        {
+            const __m128 v = _mm_loadu_ps(texels);
+            const __m256 spread = _mm256_set_m128(_mm_unpackhi_ps(v, v), _mm_unpacklo_ps(v, v));
+            _mm256_maskstore_ps(dst, _mm256_setr_epi32(-1, 0, -1, 0, -1, 0, -1, 0), spread);
+            return;
+        }
+#endif
+        for (int c = 0; c < count; ++c) dst[c * strideX] = texels[c];
+    }
+
+    inline int decode_min_band(const int width)
+    {
+        return std::max(1, (1 << 15) / std::max(1, 4 * width));
+    }
+
+    // Bands of block rows decode on separate workers
+    inline void decode_blocks(const gli::texture & t, const size_t image, const size_t level, const block_kind kind, const channel_weights & w, const image_view<float, 1> & out)
+    {
+        const int blocksX = (out.size.x + 3) / 4;
+        const int blocksY = (out.size.y + 3) / 4;
+        const size_t blockBytes = gli::block_size(t.format());
+        const uint8_t * blocks = reinterpret_cast<const uint8_t *>(t.data(image / t.faces(), image % t.faces(), level));
+
+        parallel_for(0, blocksY, [&](int by0, int by1, int)
+        {
+            alignas(32) float texels[16];
+            for (int by = by0; by < by1; ++by)
+            {
+                for (int bx = 0; bx < blocksX; ++bx)
+                {
+                    block_values(kind, blocks + (size_t(by) * blocksX + bx) * blockBytes, w, texels);
+
+                    // Levels smaller than a block only keep the texels inside the level
+                    const int cols = std::min(4, out.size.x - bx * 4);
+                    for (int row = 0; row < 4 && by * 4 + row < out.size.y; ++row)
+                    {
+                        store_block_row(&out(by * 4 + row, bx * 4), out.stride.x, texels + 4 * row, cols);
+                    }
+                }
+            }
+        }, decode_min_band(out.size.x));
+    }
+}
+
+// Formats texture_level_to_channel reads: the BC1-BC5 block formats it decodes itself and every
+// uncompressed format gli::convert handles
+inline bool can_decode_texture_format(const gli::format format)
+{
+    switch (format)
+    {
+    case gli::FORMAT_RGB_DXT1_UNORM_BLOCK8: case gli::FORMAT_RGB_DXT1_SRGB_BLOCK8:
+    case gli::FORMAT_RGBA_DXT1_UNORM_BLOCK8: case gli::FORMAT_RGBA_DXT1_SRGB_BLOCK8:
+    case gli::FORMAT_RGBA_DXT3_UNORM_BLOCK16: case gli::FORMAT_RGBA_DXT3_SRGB_BLOCK16:
+    case gli::FORMAT_RGBA_DXT5_UNORM_BLOCK16: case gli::FORMAT_RGBA_DXT5_SRGB_BLOCK16:
+    case gli::FORMAT_R_ATI1N_UNORM_BLOCK8:
+    case gli::FORMAT_RG_ATI2N_UNORM_BLOCK16:
+        return true;
+    default:
+        return !gli::is_compressed(format);
+    }
+}
+
+// Array layers and cube faces of a texture, flattened layer-major as the images of texture_level_to_channel
+inline size_t texture_images(const gli::texture & t)
+{
+    return t.layers() * t.faces();
+}
+
+// One channel of one mip level of one image (layer/face, see texture_images). BC1-BC5 decode straight
+// to the channel without going through RGBA; uncompressed formats go through gli::convert. Channels a
+// format lacks read as zero. out may alias the real or imaginary parts of an FFT input buffer (see
+// real_view in spectrum.hpp), which makes the interleaved-to-planar split part of the decode.
+inline void texture_level_to_channel(const gli::texture & t, const size_t level, const channel_weights & w, const image_view<float, 1> & out, const size_t image = 0)
+{
+    assert(out.size.x == t.extent(level).x && out.size.y == t.extent(level).y);
+
+    scoped_timer timer("decode");
+
+    using detail::block_kind;
+
+    switch (t.format())
+    {
+    case gli::FORMAT_RGB_DXT1_UNORM_BLOCK8: case gli::FORMAT_RGB_DXT1_SRGB_BLOCK8:
+    case gli::FORMAT_RGBA_DXT1_UNORM_BLOCK8: case gli::FORMAT_RGBA_DXT1_SRGB_BLOCK8:
+        detail::decode_blocks(t, image, level, block_kind::bc1, w, out);
+        return;
+    case gli::FORMAT_RGBA_DXT3_UNORM_BLOCK16: case gli::FORMAT_RGBA_DXT3_SRGB_BLOCK16:
+        detail::decode_blocks(t, image, level, block_kind::bc2, w, out);
+        return;
+    case gli::FORMAT_RGBA_DXT5_UNORM_BLOCK16: case gli::FORMAT_RGBA_DXT5_SRGB_BLOCK16:
+        detail::decode_blocks(t, image, level, block_kind::bc3, w, out);
+        return;
+    case gli::FORMAT_R_ATI1N_UNORM_BLOCK8:
+        detail::decode_blocks(t, image, level, block_kind::bc4, w, out);
+        return;
+    case gli::FORMAT_RG_ATI2N_UNORM_BLOCK16:
+        detail::decode_blocks(t, image, level, block_kind::bc5, w, out);
+        return;
+    default:
+        break;
+    }
+
+    if (gli::is_compressed(t.format())) throw std::runtime_error("unsupported compressed format");
+
+    const size_t layer = image / t.faces(), face = image % t.faces();
+    const gli::texture2d source(gli::texture(t, gli::TARGET_2D, t.format(), layer, layer, face, face, level, level));
+    const gli::texture2d converted = gli::convert(source, gli::FORMAT_RGBA32_SFLOAT_PACK32);
+    const glm::vec4 * texels = converted.data<glm::vec4>(0, 0, 0);
+
+    for (int y = 0; y < out.size.y; ++y)
+    {
+        for (int x = 0; x < out.size.x; ++x)
+        {
+            const glm::vec4 & c = texels[y * out.size.x + x];
+            out(y, x) = w(c.r, c.g, c.b, c.a);
+        }
+    }
+}
+
+inline void texture_level_to_luminance(const gli::texture & t, const size_t level, const image_view<float, 1> & out, const size_t image = 0)
+{
+    texture_level_to_channel(t, level, luminance_weights, out, image);
+}
+
+// Decodes the first out.levels() levels of the authored mip chain. Large levels split their block
+// rows across the workers; the small tail of the chain decodes one level per worker instead.
+inline void texture_to_luminance_pyramid(const gli::texture & t, image_buffer_pyramid<float, 1> & out)
+{
+    assert(out.levels() <= t.levels());
+
+    int firstSerialLevel = 0;
+    for (; firstSerialLevel < (int) out.levels(); ++firstSerialLevel)
+    {
+        const int2 size = out.level(firstSerialLevel).size;
+        if (band_count((size.y + 3) / 4, detail::decode_min_band(size.x)) <= 1) break;
+        texture_level_to_luminance(t, firstSerialLevel, out.level(firstSerialLevel));
+    }
+
+    parallel_for(firstSerialLevel, (int) out.levels(), [&](int l0, int l1, int)
+    {
+        for (int l = l0; l < l1; ++l) texture_level_to_luminance(t, l, out.level(l));
+    });
+}
+
+#endif // end texture_decode_hpp
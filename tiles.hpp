@@ -0,0 +1,128 @@
+#ifndef tiles_hpp
+#define tiles_hpp
+
+#include <vector>
+#include <algorithm>
+#include "image.hpp"
+#include "reduce.hpp"
+
+////////////////////////
+//   Spectrum Tiles   //
+////////////////////////
+
+namespace detail
+{
+    // out(y, x) is the mean of the (1 << lod)^2 block of in at ((origin + (x, y)) << lod), with in read
+    // as if shifted by shift (wrapping around, as fftshift does). Blocks cut by the edge of in average
+    // what lies inside; blocks wholly outside are 0.
+    inline void reduce_blocks(const image_view<const float, 1> & in, const int2 shift, const int lod, const int2 origin, const image_view<float, 1> & out)
+    {
+        const int scale = 1 << lod;
+        const int x0 = std::min(in.size.x, origin.x * scale);
+        const int x1 = std::min(in.size.x, (origin.x + out.size.x) * scale);
+
+        // Source column of every shifted column the output spans
+        std::vector<int> columns(x1 - x0);
+        for (int cx = x0; cx < x1; ++cx) columns[cx - x0] = (cx + shift.x) % in.size.x;
+
+        const int minBand = std::max(1, (1 << 16) / std::max(1, out.size.x * scale * scale));
+        parallel_for(0, out.size.y, [&](int y0, int y1, int)
+        {
+            std::vector<float> sums(out.size.x);
+            for (int y = y0; y < y1; ++y)
+            {
+                std::fill(sums.begin(), sums.end(), 0.0f);
+                const int cy0 = std::min(in.size.y, (origin.y + y) * scale);
+                const int cy1 = std::min(in.size.y, cy0 + scale);
+                for (int cy = cy0; cy < cy1; ++cy)
+                {
+                    const float * src = in.row((cy + shift.y) % in.size.y);
+                    for (size_t i = 0; i < columns.size(); ++i) sums[i >> lod] += src[std::ptrdiff_t(columns[i]) * in.stride.x];
+                }
+
+                for (int x = 0; x < out.size.x; ++x)
+                {
+                    const int count = (cy1 - cy0) * std::max(0, std::min(scale, x1 - (x0 + x * scale)));
+                    out(y, x) = count > 0 ? sums[x] / count : 0.0f;
+                }
+            }
+        }, minBand);
+    }
+}
+
+// A spectrum larger than the screen, or than one GL texture, is drawn from square tiles of its centered
+// (fftshifted) image at the level of detail of the zoom: at LOD k a texel averages 2^k x 2^k bins. Tiles
+// are made on demand from the retained spectrum, which must outlive this. An overview of the whole
+// image at the first LOD no larger than overview_max_size is made up front; coarser tiles come from it,
+// and it stands in for finer tiles until they are made. Tiles hold raw values; the statistics of the
+// whole spectrum, log histogram included, are gathered here in one pass so any display mapping can be
+// applied to them later.
+class spectrum_tiles
+{
+    image_view<const float, 1> spectrum;
+    int overviewLod = 0;
+    std::unique_ptr<image_buffer<float, 1>> overviewImage;
+    reduction spectrumStats;
+
+public:
+
+    static const int tile_size = 256;
+    static const int overview_max_size = 2048;
+
+    explicit spectrum_tiles(const image_view<const float, 1> & spectrum) : spectrum(spectrum)
+    {
+        scoped_timer timer("tiles");
+        if (spectrum.has_unit_pixel_stride() && spectrum.stride.y == spectrum.size.x) spectrumStats = reduce_values(spectrum.origin, size_t(spectrum.num_pixels()), true);
+        else
+        {
+            for (int y = 0; y < spectrum.size.y; ++y)
+            {
+                const reduction row = reduce_values(spectrum.row(y), size_t(spectrum.size.x), true);
+                spectrumStats.merge(row);
+                spectrumStats.histogram.merge(row.histogram);
+            }
+        }
+
+        while (std::max(lod_size(overviewLod).x, lod_size(overviewLod).y) > overview_max_size) ++overviewLod;
+        overviewImage.reset(new image_buffer<float, 1>(lod_size(overviewLod)));
+        detail::reduce_blocks(spectrum, spectrum.size - spectrum.size / 2, overviewLod, { 0, 0 }, overviewImage->view());
+    }
+
+    const int2 & size() const { return spectrum.size; }
+    int overview_lod() const { return overviewLod; }
+    image_view<const float, 1> overview() const { return overviewImage->view(); }
+    const reduction & stats() const { return spectrumStats; }
+
+    // Partial blocks at the far edges count as whole texels
+    int2 lod_size(const int lod) const
+    {
+        const int scale = 1 << lod;
+        return { (spectrum.size.x + scale - 1) / scale, (spectrum.size.y + scale - 1) / scale };
+    }
+
+    int2 tile_count(const int lod) const
+    {
+        const int2 s = lod_size(lod);
+        return { (s.x + tile_size - 1) / tile_size, (s.y + tile_size - 1) / tile_size };
+    }
+
+    // Texels of the tile that lie inside the image; the rest of a tile_size^2 tile is 0
+    int2 tile_extent(const int lod, const int2 tile) const
+    {
+        const int2 s = lod_size(lod);
+        return { std::min(tile_size, s.x - tile.x * tile_size), std::min(tile_size, s.y - tile.y * tile_size) };
+    }
+
+    // out is tile_size x tile_size
+    void fill_tile(const int lod, const int2 tile, const image_view<float, 1> & out) const
+    {
+        assert(out.size == int2(tile_size, tile_size));
+
+        scoped_timer timer("tiles");
+        const int2 origin = tile * tile_size;
+        if (lod >= overviewLod) detail::reduce_blocks(overview(), { 0, 0 }, lod - overviewLod, origin, out);
+        else detail::reduce_blocks(spectrum, spectrum.size - spectrum.size / 2, lod, origin, out);
+    }
+};
+
+#endif // end tiles_hpp
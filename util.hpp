@@ -1,6 +1,7 @@
 #ifndef util_hpp
 #define util_hpp
 
+#include <atomic>
 #include "linalg_util.hpp"
 #include "gli/gli.hpp"
 #include "third-party/stb/stb_image.h"
@@ -88,14 +89,18 @@ inline bool take_screenshot(int2 size)
     return false;
 }
 
+// Redraws are requested rather than continuous: input, resizes and exposes request one, and any
+// thread can request one (request_redraw wakes wait_events) when it has a new result to show.
 class Window
 {
     GLFWwindow * window;
+    std::atomic<bool> redrawRequested { true };
 public:
     std::function<void(unsigned int codepoint)> on_char;
     std::function<void(int key, int action, int mods)> on_key;
     std::function<void(int button, int action, int mods)> on_mouse_button;
     std::function<void(float2 pos)> on_cursor_pos;
+    std::function<void(float2 offset)> on_scroll;
     std::function<void(int numFiles, const char ** paths)> on_drop;
 
     Window(int width, int height, const char * title)
@@ -120,25 +125,33 @@ public:
         }
 
         glfwSetCharCallback(window, [](GLFWwindow * window, unsigned int codepoint) {
-            auto w = (Window *)glfwGetWindowUserPointer(window); if (w->on_char) w->on_char(codepoint);
+            auto w = (Window *)glfwGetWindowUserPointer(window); w->redrawRequested = true; if (w->on_char) w->on_char(codepoint);
         });
 
         glfwSetKeyCallback(window, [](GLFWwindow * window, int key, int, int action, int mods) {
-            auto w = (Window *)glfwGetWindowUserPointer(window); if (w->on_key) w->on_key(key, action, mods);
+            auto w = (Window *)glfwGetWindowUserPointer(window); w->redrawRequested = true; if (w->on_key) w->on_key(key, action, mods);
         });
 
         glfwSetMouseButtonCallback(window, [](GLFWwindow * window, int button, int action, int mods) {
-            auto w = (Window *)glfwGetWindowUserPointer(window); if (w->on_mouse_button) w->on_mouse_button(button, action, mods);
+            auto w = (Window *)glfwGetWindowUserPointer(window); w->redrawRequested = true; if (w->on_mouse_button) w->on_mouse_button(button, action, mods);
         });
 
         glfwSetCursorPosCallback(window, [](GLFWwindow * window, double xpos, double ypos) {
             auto w = (Window *)glfwGetWindowUserPointer(window); if (w->on_cursor_pos) w->on_cursor_pos(float2(double2(xpos, ypos)));
         });
 
+        glfwSetScrollCallback(window, [](GLFWwindow * window, double xoffset, double yoffset) {
+            auto w = (Window *)glfwGetWindowUserPointer(window); w->redrawRequested = true; if (w->on_scroll) w->on_scroll(float2(double2(xoffset, yoffset)));
+        });
+
         glfwSetDropCallback(window, [](GLFWwindow * window, int numFiles, const char ** paths) {
-            auto w = (Window *)glfwGetWindowUserPointer(window); if (w->on_drop) w->on_drop(numFiles, paths);
+            auto w = (Window *)glfwGetWindowUserPointer(window); w->redrawRequested = true; if (w->on_drop) w->on_drop(numFiles, paths);
         });
 
+        // Pointer motion only redraws through whatever on_cursor_pos requests
+        glfwSetWindowRefreshCallback(window, [](GLFWwindow * window) { ((Window *)glfwGetWindowUserPointer(window))->redrawRequested = true; });
+        glfwSetFramebufferSizeCallback(window, [](GLFWwindow * window, int, int) { ((Window *)glfwGetWindowUserPointer(window))->redrawRequested = true; });
+
         glfwSetWindowUserPointer(window, this);
     }
 
@@ -163,6 +176,20 @@ public:
     float2 get_cursor_pos() const { double2 pos; glfwGetCursorPos(window, &pos.x, &pos.y); return float2(pos); }
 
     void swap_buffers() { glfwSwapBuffers(window); }
+    void set_vsync(const bool enabled) { glfwSwapInterval(enabled ? 1 : 0); }
+
+    // Safe from any thread
+    void request_redraw()
+    {
+        redrawRequested = true;
+        glfwPostEmptyEvent();
+    }
+
+    bool redraw_requested() const { return redrawRequested; }
+    void clear_redraw_request() { redrawRequested = false; }
+
+    // Processes pending events; blocks until one arrives when block is set
+    void wait_events(const bool block) { if (block) glfwWaitEvents(); else glfwPollEvents(); }
     void close() { glfwSetWindowShouldClose(window, 1); }
 };
 